@@ -2,31 +2,35 @@
 #define AABB_H
 
 #include "rtweekend.h"
+#include "counters.h"
 
 class aabb {
 public:
     aabb() {}
-    aabb(const point3& a, const point3& b) { _min = a; _max = b; }
-
-    point3 min() const { return _min; }
-    point3 max() const { return _max; }
-
-    bool hit(const ray& r, double tmin, double tmax) const{
+    aabb(const point3& a, const point3& b) { bounds[0] = a; bounds[1] = b; }
+
+    point3 min() const { return bounds[0]; }
+    point3 max() const { return bounds[1]; }
+
+    // The slab test, without branches: the sign of the direction indexes the
+    // near and far planes of each slab, and the comparisons compile to min
+    // and max instructions. A ray in the plane of a slab gives 0 * inf = NaN
+    // there, which the comparisons pass over, so the slab does not cull it.
+    // The far distances are widened by their rounding error, so that the box
+    // of a primitive never culls a ray that grazes the primitive.
+    bool hit(const ray& r, real tmin, real tmax) const {
+        add_count(counter::box_tests);
+        const real far_slack = 1 + 3 * std::numeric_limits<real>::epsilon();
         for (int a = 0; a < 3; a++) {
-            auto t0 = fmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                           (_max[a] - r.origin()[a]) / r.direction()[a]);
-            auto t1 = fmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                           (_max[a] - r.origin()[a]) / r.direction()[a]);
-            tmin = fmax(t0, tmin);
-            tmax = fmin(t1, tmax);
-            if (tmax <= tmin)
-                return false;
+            auto t0 = (bounds[r.dir_is_neg[a]][a] - r.orig[a]) * r.inv_dir[a];
+            auto t1 = (bounds[1 - r.dir_is_neg[a]][a] - r.orig[a]) * r.inv_dir[a] * far_slack;
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
         }
-        return true;
+        return tmin < tmax;
     }
 
-    point3 _min;
-    point3 _max;
+    point3 bounds[2]; // min, max
 };
 
 inline aabb surrounding_box(aabb box0, aabb box1) {
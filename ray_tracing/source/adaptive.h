@@ -0,0 +1,126 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Decides, between passes, which pixels still need samples. A pixel is done
+// once it has max_samples, or once it has min_samples and the standard error
+// of its mean luminance, measured after gamma 2 like the written image, is
+// below target_error everywhere in its 3x3 neighbourhood. Looking at the
+// neighbours keeps a pixel from stopping early just because its first few
+// samples happened to agree, as happens next to rare bright paths.
+//
+// A target_error of zero never stops early and takes max_samples everywhere.
+class adaptive_sampler {
+public:
+    adaptive_sampler(float target, int min_spp, int max_spp)
+        : target_error(target), min_samples(min_spp), max_samples(max_spp) {}
+
+    // Recomputes the active pixels from the samples so far and returns their
+    // number. Depends only on samples, so a resumed render picks the same ones.
+    size_t update(const accumulation_buffer& samples);
+
+    bool active(int i, int j) const { return active_pixels[size_t(height - 1 - j) * width + i] != 0; }
+
+    // Samples to take in pixel (i, j) in the next pass, which holds pass_samples
+    // per pixel except that the first pass goes straight to min_samples.
+    int samples_for_pass(const accumulation_buffer& samples, int i, int j, int pass_samples) const;
+
+    void print_stats(const accumulation_buffer& samples, std::ostream& out) const;
+
+    // Image of the samples taken per pixel, white at max_samples.
+    void sample_map(const accumulation_buffer& samples, framebuffer& image) const;
+
+public:
+    float target_error;
+    int min_samples;
+    int max_samples;
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> active_pixels; // storage order of accumulation_buffer
+};
+
+size_t adaptive_sampler::update(const accumulation_buffer& samples) {
+    width = samples.width;
+    height = samples.height;
+    auto pixel_count = samples.counts.size();
+
+    std::vector<float> error(pixel_count);
+    for (size_t k = 0; k < pixel_count; ++k) {
+        auto mean = std::max(samples.mean_luminance(k), 0.0f);
+        error[k] = std::sqrt(mean + samples.standard_error(k)) - std::sqrt(mean);
+    }
+
+    active_pixels.assign(pixel_count, 0);
+    size_t active_count = 0;
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            auto k = size_t(y) * width + x;
+            auto n = samples.counts[k];
+            bool needs_samples = n < static_cast<uint32_t>(max_samples);
+
+            if (needs_samples && n >= static_cast<uint32_t>(min_samples) && target_error > 0) {
+                auto worst = 0.0f;
+                for (int dy = std::max(0, y - 1); dy <= std::min(height - 1, y + 1); ++dy)
+                    for (int dx = std::max(0, x - 1); dx <= std::min(width - 1, x + 1); ++dx)
+                        worst = std::max(worst, error[size_t(dy) * width + dx]);
+                needs_samples = worst > target_error;
+            }
+
+            active_pixels[k] = needs_samples;
+            active_count += needs_samples;
+        }
+    }
+
+    return active_count;
+}
+
+int adaptive_sampler::samples_for_pass(
+    const accumulation_buffer& samples, int i, int j, int pass_samples
+) const {
+    if (!active(i, j))
+        return 0;
+    int n = samples.sample_count(i, j);
+    int goal = n < min_samples ? min_samples : n + pass_samples;
+    return std::min(goal, max_samples) - n;
+}
+
+void adaptive_sampler::print_stats(const accumulation_buffer& samples, std::ostream& out) const {
+    uint64_t total = 0;
+    uint32_t lowest = std::numeric_limits<uint32_t>::max(), highest = 0;
+    size_t at_min = 0, at_max = 0;
+
+    for (auto n : samples.counts) {
+        total += n;
+        lowest = std::min(lowest, n);
+        highest = std::max(highest, n);
+        at_min += n <= static_cast<uint32_t>(min_samples);
+        at_max += n >= static_cast<uint32_t>(max_samples);
+    }
+
+    auto pixel_count = double(samples.counts.size());
+    out << "Samples per pixel: mean " << total / pixel_count
+        << ", min " << lowest << ", max " << highest
+        << ", " << 100.0 * total / (pixel_count * max_samples) << "% of the budget\n"
+        << "Pixels stopped at " << min_samples << ": " << 100.0 * at_min / pixel_count
+        << "%, ran to " << max_samples << ": " << 100.0 * at_max / pixel_count << "%\n";
+}
+
+void adaptive_sampler::sample_map(const accumulation_buffer& samples, framebuffer& image) const {
+    image.resize(samples.width, samples.height);
+    for (size_t k = 0; k < samples.counts.size(); ++k) {
+        // Squared so that the gamma 2 of the writers maps sample counts linearly.
+        auto v = float(samples.counts[k]) / max_samples;
+        for (int c = 0; c < 3; c++)
+            image.pixels[3*k + c] = v * v;
+    }
+}
+
+#endif
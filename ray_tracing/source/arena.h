@@ -0,0 +1,100 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using std::shared_ptr;
+
+// A monotonic allocator for the objects of a scene. Allocations are carved
+// one after the other out of large blocks, so objects built together sit
+// together in memory, and nothing is returned until the arena itself is
+// destroyed, which releases every block at once.
+//
+// make() returns shared_ptrs so that arena objects mix with make_shared ones,
+// but they all share one control block owned by the arena instead of carrying
+// one each. Copying them does not keep anything alive: the arena runs the
+// destructors, in reverse order of construction, when it is destroyed, and must
+// outlive every pointer it made. Not thread safe.
+class arena {
+public:
+    explicit arena(size_t block = 1 << 16)
+        : block_size(block), anchor(static_cast<void*>(this), [](void*) {}) {}
+    ~arena();
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment);
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make(Args&&... args);
+
+    // Bytes handed out so far, and bytes held in blocks.
+    size_t bytes_used() const { return used; }
+    size_t bytes_reserved() const { return reserved; }
+
+private:
+    struct destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    size_t block_size;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<destructor> destructors; // of objects that need one
+    shared_ptr<void> anchor;
+    char* next = nullptr;
+    size_t remaining = 0;
+    size_t used = 0;
+    size_t reserved = 0;
+};
+
+arena::~arena() {
+    for (auto d = destructors.rbegin(); d != destructors.rend(); ++d)
+        d->destroy(d->object);
+}
+
+void* arena::allocate(size_t size, size_t alignment) {
+    auto padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+
+    if (!next || padding + size > remaining) {
+        // Requests larger than a block get a block of their own.
+        auto bytes = std::max(block_size, size + alignment);
+        blocks.emplace_back(new char[bytes]);
+        next = blocks.back().get();
+        remaining = bytes;
+        reserved += bytes;
+        padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+    }
+
+    auto p = next + padding;
+    next += padding + size;
+    remaining -= padding + size;
+    used += size;
+    return p;
+}
+
+template <typename T, typename... Args>
+shared_ptr<T> arena::make(Args&&... args) {
+    auto object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value)
+        destructors.push_back({object, [](void* p) { static_cast<T*>(p)->~T(); }});
+    return shared_ptr<T>(anchor, object);
+}
+
+// make_shared, or arena::make when storage is given.
+template <typename T, typename... Args>
+shared_ptr<T> make_in(arena* storage, Args&&... args) {
+    if (storage)
+        return storage->make<T>(std::forward<Args>(args)...);
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+#endif
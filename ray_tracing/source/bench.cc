@@ -0,0 +1,973 @@
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "arena.h"
+#include "scene.h"
+#include "sphere_soa.h"
+#include "instance.h"
+#include "motion_bvh.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// Every allocation of the benchmark goes through these, so the live heap size
+// can be sampled around the construction of each structure. An allocation of n
+// bytes counts what glibc's malloc(n) takes, with its 8-byte header and 16-byte
+// granularity, so that many small objects compare fairly against few big ones.
+std::atomic<size_t> live_bytes(0);
+
+size_t heap_cost(size_t n) {
+    return std::max<size_t>(32, (n + 8 + 15) & ~size_t(15));
+}
+
+void* tracked_alloc(size_t n, size_t alignment) {
+    alignment = std::max<size_t>(alignment, 16);
+    auto raw = static_cast<char*>(std::malloc(n + alignment));
+    if (!raw) throw std::bad_alloc();
+    auto user = raw + alignment;
+    reinterpret_cast<void**>(user)[-1] = raw;
+    reinterpret_cast<size_t*>(user)[-2] = n;
+    live_bytes += heap_cost(n);
+    return user;
+}
+
+void tracked_free(void* p) noexcept {
+    if (!p) return;
+    live_bytes -= heap_cost(reinterpret_cast<size_t*>(p)[-2]);
+    std::free(reinterpret_cast<void**>(p)[-1]);
+}
+
+void* operator new(size_t n) { return tracked_alloc(n, 16); }
+void* operator new(size_t n, std::align_val_t a) { return tracked_alloc(n, size_t(a)); }
+void operator delete(void* p) noexcept { tracked_free(p); }
+void operator delete(void* p, size_t) noexcept { tracked_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { tracked_free(p); }
+
+double elapsed_ms(bench_clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - begin).count();
+}
+
+// Camera rays for a width x height image plus one diffuse bounce from every
+// primary hit, which gives a mix of coherent and incoherent queries.
+std::vector<ray> make_rays(const camera& cam, const hittable& world, int width, int height) {
+    std::vector<ray> rays;
+
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            seed_sample(0, size_t(j) * width + i, 0);
+            auto u = (i + random_double()) / (width - 1);
+            auto v = (j + random_double()) / (height - 1);
+            rays.push_back(cam.get_ray(u, v));
+        }
+    }
+
+    auto primary_count = rays.size();
+    for (size_t k = 0; k < primary_count; ++k) {
+        hit_record rec;
+        if (!world.hit(rays[k], 0, infinity, rec))
+            continue;
+
+        // sphere_soa rounds the scene to float, so even a double build has to
+        // start the bounce past the float rounding error, or it would hit the
+        // float copy of the surface it leaves.
+        auto magnitude = rec.error / rounding_error(8);
+        rec.error = std::max(rec.error, real(magnitude * 8 * std::numeric_limits<float>::epsilon()));
+        rays.push_back(rec.spawn_ray(rec.normal + random_unit_vector(), rays[k].time()));
+    }
+
+    return rays;
+}
+
+// Sixteen camera samples per pixel, stored pixel by pixel so that every run of
+// 4, 8 or 16 rays is a coherent packet.
+std::vector<ray> make_primary_rays(const camera& cam, int width, int height) {
+    std::vector<ray> rays;
+
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            for (int s = 0; s < max_packet_size; ++s) {
+                seed_sample(0, size_t(j) * width + i, s);
+                auto u = (i + random_double()) / (width - 1);
+                auto v = (j + random_double()) / (height - 1);
+                rays.push_back(cam.get_ray(u, v));
+            }
+        }
+    }
+
+    return rays;
+}
+
+// Returns Mrays/s and counts the hits, tracing packet_size rays at a time, or
+// one by one when packet_size is zero.
+double trace_primary(
+    const linear_bvh& world, const std::vector<ray>& rays, int packet_size, size_t& hit_count
+) {
+    hit_record recs[max_packet_size];
+    bool hits[max_packet_size];
+    hit_count = 0;
+
+    auto begin = bench_clock::now();
+
+    if (packet_size == 0) {
+        for (const auto& r : rays)
+            hit_count += world.hit(r, 0, infinity, recs[0]);
+    } else {
+        for (size_t k = 0; k < rays.size(); k += packet_size) {
+            world.hit_packet(&rays[k], packet_size, 0, infinity, recs, hits);
+            for (int l = 0; l < packet_size; ++l)
+                hit_count += hits[l];
+        }
+    }
+
+    return rays.size() / (elapsed_ms(begin) * 1000.0);
+}
+
+struct trace_result {
+    double ms;
+    size_t hits;
+    double nodes_per_ray;      // zero when the structure cannot count them
+    double primitives_per_ray;
+};
+
+// Traces the rays repeat times and keeps the fastest pass, which filters out
+// most of the noise of a shared machine.
+trace_result trace(const hittable& world, const std::vector<ray>& rays, int repeat) {
+    trace_result result = {infinity, 0, 0, 0};
+
+    for (int n = 0; n < repeat; ++n) {
+        auto begin = bench_clock::now();
+        size_t hits = 0;
+        for (const auto& r : rays) {
+            hit_record rec;
+            if (world.hit(r, 0, infinity, rec))
+                hits++;
+        }
+        result.ms = std::min(result.ms, elapsed_ms(begin));
+        result.hits = hits;
+    }
+
+    // Count traversal work in a separate pass so it does not skew the timing.
+    auto count = [&](const auto* structure) {
+        traversal_stats stats;
+        for (const auto& r : rays) {
+            hit_record rec;
+            structure->hit_counted(r, 0, infinity, rec, stats);
+        }
+        result.nodes_per_ray = double(stats.nodes) / rays.size();
+        result.primitives_per_ray = double(stats.primitives) / rays.size();
+    };
+    if (auto flat = dynamic_cast<const linear_bvh*>(&world))
+        count(flat);
+    else if (auto motion = dynamic_cast<const motion_bvh*>(&world))
+        count(motion);
+    else if (auto soa = dynamic_cast<const sphere_soa*>(&world))
+        count(soa);
+    else if (auto mesh = dynamic_cast<const triangle_mesh*>(&world))
+        count(mesh);
+#if RT_COUNTERS
+    else {
+        // The rest count through the build-wide counters instead.
+        auto before = total_counters();
+        for (const auto& r : rays) {
+            hit_record rec;
+            world.hit(r, 0, infinity, rec);
+        }
+        auto after = total_counters();
+        result.nodes_per_ray = double(after[counter::node_visits] - before[counter::node_visits]) / rays.size();
+        result.primitives_per_ray =
+            double(after[counter::primitive_tests] - before[counter::primitive_tests]) / rays.size();
+    }
+#endif
+
+    return result;
+}
+
+// A visibility query: does anything lie along r before t_max?
+struct occlusion_query {
+    ray r;
+    real t_max;
+};
+
+// From the primary hit of every pixel, a shadow ray to a point light and an
+// ambient occlusion ray of length ao_radius in a cosine-distributed direction.
+void make_occlusion_queries(
+    const camera& cam, const hittable& world, int width, int height, const point3& light,
+    real ao_radius, std::vector<occlusion_query>& shadow, std::vector<occlusion_query>& ao
+) {
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            seed_sample(0, size_t(j) * width + i, 1);
+            auto u = (i + random_double()) / (width - 1);
+            auto v = (j + random_double()) / (height - 1);
+            auto r = cam.get_ray(u, v);
+
+            hit_record rec;
+            if (!world.hit(r, 0, infinity, rec))
+                continue;
+
+            // Past the float rounding error, as in make_rays.
+            auto magnitude = rec.error / rounding_error(8);
+            rec.error = std::max(rec.error, real(magnitude * 8 * std::numeric_limits<float>::epsilon()));
+
+            auto to_light = light - rec.p;
+            shadow.push_back({rec.spawn_ray(to_light, r.time()), real(0.999)});
+            ao.push_back({rec.spawn_ray(unit_vector(rec.normal + random_unit_vector()), r.time()), ao_radius});
+        }
+    }
+}
+
+// Like trace(), for visibility queries answered by occluded(), or by hit()
+// when any_hit is false.
+trace_result trace_occlusion(
+    const hittable& world, const std::vector<occlusion_query>& queries, bool any_hit, int repeat
+) {
+    trace_result result = {infinity, 0, 0, 0};
+
+    for (int n = 0; n < repeat; ++n) {
+        auto begin = bench_clock::now();
+        size_t hits = 0;
+        for (const auto& q : queries) {
+            hit_record rec;
+            if (any_hit ? world.occluded(q.r, 0, q.t_max) : world.hit(q.r, 0, q.t_max, rec))
+                hits++;
+        }
+        result.ms = std::min(result.ms, elapsed_ms(begin));
+        result.hits = hits;
+    }
+
+    return result;
+}
+
+// The slab test aabb::hit used before rays carried their inverse direction:
+// six divisions, libm fmin and fmax, and a branch out of every axis.
+bool divide_slab_test(const aabb& box, const ray& r, real tmin, real tmax) {
+    for (int a = 0; a < 3; a++) {
+        auto t0 = fmin((box.min()[a] - r.origin()[a]) / r.direction()[a],
+                       (box.max()[a] - r.origin()[a]) / r.direction()[a]);
+        auto t1 = fmax((box.min()[a] - r.origin()[a]) / r.direction()[a],
+                       (box.max()[a] - r.origin()[a]) / r.direction()[a]);
+        tmin = fmax(t0, tmin);
+        tmax = fmin(t1, tmax);
+        if (tmax <= tmin)
+            return false;
+    }
+    return true;
+}
+
+// Tests every ray against every box with test, repeat times, and returns the
+// fastest pass in ms and the number of overlaps.
+template <typename Test>
+std::pair<double, size_t> time_slab_test(
+    const std::vector<aabb>& boxes, const std::vector<ray>& rays, int repeat, Test test
+) {
+    double best = infinity;
+    size_t overlaps = 0;
+    for (int n = 0; n < repeat; ++n) {
+        auto begin = bench_clock::now();
+        overlaps = 0;
+        for (const auto& r : rays) {
+            for (const auto& box : boxes)
+                overlaps += test(box, r);
+        }
+        best = std::min(best, elapsed_ms(begin));
+    }
+    return {best, overlaps};
+}
+
+void report(const char* name, double build_ms, const trace_result& result, size_t ray_count) {
+    std::cout << std::left << std::setw(14) << name
+              << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << build_ms
+              << std::setw(10) << result.ms
+              << std::setw(10) << ray_count / (result.ms * 1000.0);
+
+    if (result.nodes_per_ray > 0)
+        std::cout << std::setw(10) << result.nodes_per_ray
+                  << std::setw(10) << result.primitives_per_ray;
+    else
+        std::cout << std::setw(10) << '-' << std::setw(10) << '-';
+
+    std::cout << std::setw(10) << result.hits << '\n';
+}
+
+// A closed, lumpy sphere of 2 * rings * segments triangles, one unit in
+// radius, so that the mesh scenes need no file and are the same everywhere.
+triangle_mesh make_blob_mesh(int rings, int segments) {
+    triangle_mesh mesh;
+    for (int i = 0; i <= rings; ++i) {
+        auto theta = pi * i / rings;
+        for (int j = 0; j < segments; ++j) {
+            auto phi = 2 * pi * j / segments;
+            auto radius = 1 + 0.1 * sin(7 * theta) * cos(5 * phi);
+            mesh.positions.emplace_back(
+                radius * sin(theta) * cos(phi), radius * cos(theta), radius * sin(theta) * sin(phi));
+        }
+    }
+
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < segments; ++j) {
+            uint32_t a = i * segments + j;
+            uint32_t b = i * segments + (j + 1) % segments;
+            uint32_t c = a + segments, d = b + segments;
+            mesh.indices.insert(mesh.indices.end(), {a, c, b, b, c, d});
+        }
+    }
+    return mesh;
+}
+
+// One measurement of the suite: a scene traced through one structure.
+struct suite_result {
+    std::string scene;
+    std::string structure;
+    size_t primitives;  // stored once, however often they are instanced
+    size_t instances;   // zero for scenes without instancing
+    double build_ms;    // the acceleration structure alone, not the scene
+    size_t memory_bytes;
+    size_t rays;
+    trace_result trace;
+};
+
+void write_json(std::ostream& out, const std::vector<suite_result>& results, int width, int height, int repeat) {
+    auto number = [&](double x) -> std::ostream& {
+        if (x > 0 && x < infinity)
+            return out << std::setprecision(4) << x;
+        return out << "null";
+    };
+
+    out << "{\n"
+        << "  \"benchmark\": \"ray_tracing_bench --suite\",\n"
+        << "  \"precision\": \"" << (sizeof(real) == sizeof(float) ? "float" : "double") << "\",\n"
+        << "  \"simd_width\": " << simd_width << ",\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"repeat\": " << repeat << ",\n"
+        << "  \"results\": [\n";
+
+    for (size_t k = 0; k < results.size(); ++k) {
+        const auto& r = results[k];
+        out << std::fixed
+            << "    {\"scene\": \"" << r.scene << "\", \"structure\": \"" << r.structure << "\", "
+            << "\"primitives\": " << r.primitives << ", \"instances\": " << r.instances << ", "
+            << "\"build_ms\": ";
+        number(r.build_ms) << ", \"memory_bytes\": " << r.memory_bytes << ", "
+            << "\"rays\": " << r.rays << ", \"trace_ms\": ";
+        number(r.trace.ms) << ", \"mrays_per_s\": ";
+        number(r.rays / (r.trace.ms * 1000.0)) << ", \"nodes_per_ray\": ";
+        number(r.trace.nodes_per_ray) << ", \"primitives_per_ray\": ";
+        number(r.trace.primitives_per_ray) << ", \"hits\": " << r.trace.hits << "}"
+            << (k + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    out << "  ]\n}\n";
+}
+
+// Parses a sphere count such as 1000, 100k or 10M.
+bool parse_size(const std::string& text, size_t& count) {
+    char* end;
+    auto value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || value <= 0)
+        return false;
+    if (*end == 'k' || *end == 'K')
+        value *= 1e3, end++;
+    else if (*end == 'M' || *end == 'm')
+        value *= 1e6, end++;
+    count = static_cast<size_t>(value);
+    return *end == '\0';
+}
+
+// The standard scenes, traced with fixed seeds so that runs of different
+// commits can be compared number for number:
+//
+//   random_scene  scaled to each of sizes spheres, as sphere objects behind
+//                 a linear_bvh (up to a million of them) and as a sphere_soa
+//   mesh          a lumpy sphere of about a million triangles
+//   instanced     4096 scattered copies of that mesh under an instance_bvh
+//
+// Every scene is traced with the rays of make_rays. memory_bytes is the heap
+// taken by building the scene and its structure; for the instanced scene it
+// leaves out the shared mesh, which the mesh row already counts.
+std::vector<suite_result> run_suite(
+    const std::vector<size_t>& sizes, int width, int height, int repeat
+) {
+    const double t0 = 0.0, t1 = 1.0;
+    const size_t max_object_spheres = 1000000;
+    camera cam = random_scene_camera(real(width) / height, t0, t1);
+    std::vector<suite_result> results;
+
+    auto measure = [&](const char* scene, const char* structure, size_t primitives, size_t instances,
+                       double build_ms, size_t memory_bytes, const hittable& world) {
+        auto rays = make_rays(cam, world, width, height);
+        results.push_back({scene, structure, primitives, instances, build_ms, memory_bytes,
+                           rays.size(), trace(world, rays, repeat)});
+        const auto& r = results.back();
+        std::cerr << std::fixed << std::setprecision(2) << scene << ", " << primitives << " primitives, "
+                  << structure << ": build " << build_ms << " ms, "
+                  << r.rays / (r.trace.ms * 1000.0) << " Mrays/s\n";
+    };
+
+    for (auto size : sizes) {
+        // The grid of random_scene has (2 * half_extent)^2 cells of one sphere.
+        auto half_extent = std::max(1, static_cast<int>(std::lround(std::sqrt(double(size)) / 2)));
+
+        if (size <= max_object_spheres) {
+            auto bytes_before = live_bytes.load();
+            seed_random(0);
+            material_table materials;
+            auto scene = random_scene(materials, half_extent);
+            auto begin = bench_clock::now();
+            linear_bvh world(scene, t0, t1);
+            auto build_ms = elapsed_ms(begin);
+            measure("random_scene", "linear_bvh", scene.objects.size(), 0, build_ms,
+                    live_bytes.load() - bytes_before, world);
+        }
+
+        auto bytes_before = live_bytes.load();
+        seed_random(0);
+        material_table materials;
+        sphere_soa world;
+        sphere_soa_builder builder{world, materials};
+        build_random_scene(builder, half_extent);
+        auto begin = bench_clock::now();
+        world.build(t0, t1);
+        auto build_ms = elapsed_ms(begin);
+        measure("random_scene", "sphere_soa", world.size(), 0, build_ms,
+                live_bytes.load() - bytes_before, world);
+    }
+
+    auto bytes_before = live_bytes.load();
+    auto mesh = make_shared<triangle_mesh>(make_blob_mesh(512, 1024));
+    place_mesh(mesh->positions, point3(0, 0, 0), 2);
+    auto begin = bench_clock::now();
+    mesh->build();
+    auto build_ms = elapsed_ms(begin);
+    measure("mesh", "triangle_mesh", mesh->triangle_count(), 0, build_ms,
+            live_bytes.load() - bytes_before, *mesh);
+
+    bytes_before = live_bytes.load();
+    seed_random(0);
+    instance_bvh instances;
+    instances.add(mesh, transform());
+    scatter_instances(instances, mesh, 4095, 11, t0, t1);
+    begin = bench_clock::now();
+    instances.build();
+    build_ms = elapsed_ms(begin);
+    measure("instanced", "instance_bvh", mesh->triangle_count(), instances.size(), build_ms,
+            live_bytes.load() - bytes_before, instances);
+
+    return results;
+}
+
+int main(int argc, char* argv[]) {
+    int width = 400;
+    int repeat = 4;
+    int half_extent = 11;
+    bool suite = false;
+    std::vector<size_t> sizes = {1000, 100000, 10000000};
+    std::string json_path;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--suite")) {
+            suite = true;
+        } else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            sizes.clear();
+            std::string list = argv[++i];
+            for (size_t start = 0; start <= list.size(); ) {
+                auto end = std::min(list.find(',', start), list.size());
+                size_t count;
+                if (!parse_size(list.substr(start, end - start), count)) {
+                    std::cerr << "Invalid --sizes: " << list << '\n';
+                    return 1;
+                }
+                sizes.push_back(count);
+                start = end + 1;
+            }
+        } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (!strcmp(argv[i], "--width") && i + 1 < argc) {
+            width = std::max(4, std::stoi(argv[++i])); // two rows at 16:9
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = std::max(1, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--scale") && i + 1 < argc) {
+            half_extent = std::max(1, std::stoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--width N] [--repeat N] [--scale N]\n"
+                      << "       " << argv[0] << " --suite [--sizes N,...] [--json FILE] [--width N] [--repeat N]\n"
+                      << "--suite runs the standard scenes, random_scene at each of --sizes spheres\n"
+                      << "(1k,100k,10M by default) and a mesh with and without instancing, and\n"
+                      << "writes the results as JSON to FILE, or to stdout.\n";
+            return 1;
+        }
+    }
+
+    const auto aspect_ratio = 16.0 / 9.0;
+    const int height = static_cast<int>(width / aspect_ratio);
+
+    if (suite) {
+        auto results = run_suite(sizes, width, height, repeat);
+        if (json_path.empty()) {
+            write_json(std::cout, results, width, height, repeat);
+            return 0;
+        }
+        std::ofstream out(json_path);
+        write_json(out, results, width, height, repeat);
+        if (!out) {
+            std::cerr << "Could not write " << json_path << '\n';
+            return 1;
+        }
+        return 0;
+    }
+    const double t0 = 0.0, t1 = 1.0;
+
+    seed_random(0);
+    material_table materials;
+    hittable_list scene = random_scene(materials, half_extent);
+    camera cam = random_scene_camera(aspect_ratio, t0, t1);
+
+    seed_random(1);
+    auto begin = bench_clock::now();
+    bvh_node tree(scene, t0, t1);
+    auto tree_build_ms = elapsed_ms(begin);
+
+    seed_random(1);
+    begin = bench_clock::now();
+    linear_bvh median(scene, t0, t1, bvh_split::median);
+    auto median_build_ms = elapsed_ms(begin);
+
+    begin = bench_clock::now();
+    linear_bvh sah(scene, t0, t1, bvh_split::sah);
+    auto sah_build_ms = elapsed_ms(begin);
+
+    auto rays = make_rays(cam, tree, width, height);
+    auto ray_count = rays.size();
+
+    std::cout << "random_scene(" << half_extent << "): " << scene.objects.size() << " primitives, "
+              << rays.size() << " rays, best of " << repeat << ", "
+              << (sizeof(real) == sizeof(float) ? "float" : "double") << " vectors ("
+              << sizeof(vec3) << " B vec3, " << sizeof(ray) << " B ray)\n\n"
+              << std::left << std::setw(14) << "structure" << std::right
+              << std::setw(10) << "build ms" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "nodes/ray"
+              << std::setw(10) << "prims/ray" << std::setw(10) << "hits" << '\n';
+
+    auto tree_result = trace(tree, rays, repeat);
+    report("bvh_node", tree_build_ms, tree_result, ray_count);
+
+    auto median_result = trace(median, rays, repeat);
+    report("linear median", median_build_ms, median_result, ray_count);
+
+    auto sah_result = trace(sah, rays, repeat);
+    report("linear sah", sah_build_ms, sah_result, ray_count);
+
+    if (median_result.hits != tree_result.hits || sah_result.hits != tree_result.hits) {
+        std::cerr << "linear_bvh disagrees with bvh_node on " << rays.size() << " rays\n";
+        return 1;
+    }
+
+    // The slab test alone, every primitive box of the scene against a sample
+    // of the rays, so that nothing but box tests is timed.
+    std::vector<aabb> boxes(scene.objects.size());
+    for (size_t i = 0; i < boxes.size(); ++i)
+        scene.objects[i]->bounding_box(t0, t1, boxes[i]);
+    std::vector<ray> slab_rays;
+    for (size_t k = 0; k < rays.size(); k += 16)
+        slab_rays.push_back(rays[k]);
+
+    auto divide = time_slab_test(boxes, slab_rays, repeat,
+        [](const aabb& box, const ray& r) { return divide_slab_test(box, r, 0, infinity); });
+    auto inverse = time_slab_test(boxes, slab_rays, repeat,
+        [](const aabb& box, const ray& r) { return box.hit(r, 0, infinity); });
+    auto tests = double(boxes.size()) * slab_rays.size();
+
+    std::cout << "\nslab test, " << slab_rays.size() << " rays against " << boxes.size() << " boxes\n"
+              << std::left << std::setw(14) << "test" << std::right
+              << std::setw(10) << "ms" << std::setw(10) << "Mtests/s"
+              << std::setw(10) << "speedup" << std::setw(10) << "overlaps" << '\n';
+    for (auto row : {std::make_pair("divide", divide), std::make_pair("aabb::hit", inverse)}) {
+        std::cout << std::left << std::setw(14) << row.first << std::right
+                  << std::setw(10) << row.second.first
+                  << std::setw(10) << tests / (row.second.first * 1000.0)
+                  << std::setw(10) << divide.first / row.second.first
+                  << std::setw(10) << row.second.second << '\n';
+    }
+
+    // The widened far distance may admit a few rays that only touch a box.
+    if (inverse.second < divide.second || inverse.second - divide.second > 1e-6 * tests) {
+        std::cerr << "aabb::hit disagrees with the division slab test\n";
+        return 1;
+    }
+
+    // Spheres as separate heap objects behind linear_bvh, against sphere_soa.
+    auto bytes_before = live_bytes.load();
+    seed_random(0);
+    begin = bench_clock::now();
+    material_table object_materials;
+    auto object_scene = random_scene(object_materials, half_extent);
+    linear_bvh objects(object_scene, t0, t1);
+    auto objects_build_ms = elapsed_ms(begin);
+    auto objects_bytes = live_bytes.load() - bytes_before;
+
+    bytes_before = live_bytes.load();
+    seed_random(0);
+    begin = bench_clock::now();
+    material_table soa_materials;
+    auto soa = random_scene_soa(soa_materials, half_extent, t0, t1);
+    auto soa_build_ms = elapsed_ms(begin);
+    auto soa_bytes = live_bytes.load() - bytes_before;
+
+    auto objects_result = trace(objects, rays, repeat);
+    auto soa_result = trace(*soa, rays, repeat);
+    object_scene.clear();
+
+    std::cout << "\nspheres, scene construction and materials included in build ms and MB\n"
+              << std::left << std::setw(14) << "structure" << std::right
+              << std::setw(10) << "build ms" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "MB"
+              << std::setw(10) << "B/sphere" << std::setw(10) << "hits" << '\n';
+
+    for (auto row : {std::make_tuple("objects", objects_build_ms, objects_result, objects_bytes),
+                     std::make_tuple("sphere_soa", soa_build_ms, soa_result, soa_bytes)}) {
+        const auto& result = std::get<2>(row);
+        auto bytes = std::get<3>(row);
+        std::cout << std::left << std::setw(14) << std::get<0>(row) << std::right
+                  << std::setw(10) << std::get<1>(row) << std::setw(10) << result.ms
+                  << std::setw(10) << ray_count / (result.ms * 1000.0)
+                  << std::setw(10) << bytes / 1048576.0
+                  << std::setw(10) << double(bytes) / soa->size()
+                  << std::setw(10) << result.hits << '\n';
+    }
+
+    std::cout << "sphere_soa arrays and BVH alone: "
+              << double(soa->memory_usage()) / soa->size() << " B/sphere\n";
+
+    // sphere_soa keeps centers in single precision, so a handful of rays that
+    // barely touch a sphere may go either way.
+    if (std::abs(double(soa_result.hits) - double(objects_result.hits)) > 1e-4 * rays.size()) {
+        std::cerr << "sphere_soa disagrees with sphere objects\n";
+        return 1;
+    }
+
+    // Shadow rays toward a point light above the scene and short ambient
+    // occlusion rays, answered with the closest hit or with occluded(), which
+    // may stop at any hit and fills no hit_record.
+    std::vector<occlusion_query> shadow_queries, ao_queries;
+    make_occlusion_queries(cam, tree, width, height, point3(0, 8, 0), 1, shadow_queries, ao_queries);
+
+    std::cout << "\nvisibility, " << shadow_queries.size() << " shadow rays and "
+              << ao_queries.size() << " ambient occlusion rays\n"
+              << std::left << std::setw(14) << "structure" << std::right
+              << std::setw(10) << "rays" << std::setw(10) << "query" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "speedup"
+              << std::setw(10) << "blocked" << '\n';
+
+    for (auto row : {std::make_pair("bvh_node", static_cast<const hittable*>(&tree)),
+                     std::make_pair("linear sah", static_cast<const hittable*>(&sah)),
+                     std::make_pair("sphere_soa", static_cast<const hittable*>(soa.get()))}) {
+        for (auto kind : {std::make_pair("shadow", &shadow_queries), std::make_pair("ao", &ao_queries)}) {
+            const auto& queries = *kind.second;
+            auto closest = trace_occlusion(*row.second, queries, false, repeat);
+            auto any = trace_occlusion(*row.second, queries, true, repeat);
+            for (auto result : {std::make_pair("hit", closest), std::make_pair("occluded", any)}) {
+                std::cout << std::left << std::setw(14) << row.first << std::right
+                          << std::setw(10) << kind.first << std::setw(10) << result.first
+                          << std::setw(10) << result.second.ms
+                          << std::setw(10) << queries.size() / (result.second.ms * 1000.0)
+                          << std::setw(10) << closest.ms / result.second.ms
+                          << std::setw(10) << result.second.hits << '\n';
+            }
+
+            if (any.hits != closest.hits) {
+                std::cerr << row.first << "::occluded disagrees with hit on " << kind.first << " rays\n";
+                return 1;
+            }
+        }
+    }
+
+    // The spheres and bvh_node tree of random_scene as separate heap objects,
+    // against the same objects in an arena. "free ms" is the teardown.
+    std::cout << "\nrandom_scene and bvh_node, heap against arena\n"
+              << std::left << std::setw(14) << "allocation" << std::right
+              << std::setw(10) << "build ms" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "MB"
+              << std::setw(10) << "free ms" << std::setw(10) << "hits" << '\n';
+
+    for (bool use_arena : {false, true}) {
+        bytes_before = live_bytes.load();
+        begin = bench_clock::now();
+        auto storage = use_arena ? std::make_unique<arena>() : nullptr;
+        material_table node_materials;
+        seed_random(0);
+        auto node_scene = random_scene(node_materials, half_extent, storage.get());
+        seed_random(1);
+        auto root = make_in<bvh_node>(storage.get(), node_scene, t0, t1, storage.get());
+        auto build_ms = elapsed_ms(begin);
+        auto bytes = live_bytes.load() - bytes_before;
+
+        auto result = trace(*root, rays, repeat);
+
+        begin = bench_clock::now();
+        root.reset();
+        node_scene.clear();
+        storage.reset();
+        auto free_ms = elapsed_ms(begin);
+
+        std::cout << std::left << std::setw(14) << (use_arena ? "arena" : "heap") << std::right
+                  << std::setw(10) << build_ms << std::setw(10) << result.ms
+                  << std::setw(10) << ray_count / (result.ms * 1000.0)
+                  << std::setw(10) << bytes / 1048576.0
+                  << std::setw(10) << free_ms << std::setw(10) << result.hits << '\n';
+
+        if (result.hits != tree_result.hits) {
+            std::cerr << "bvh_node in an arena disagrees with bvh_node on the heap\n";
+            return 1;
+        }
+    }
+
+    // A cluster of spheres repeated over the ground, copied into one flat
+    // linear_bvh against one shared linear_bvh under an instance_bvh. "move ms"
+    // gives every copy a new place and rebuilds.
+    const int grid = 32, cluster_size = 64;
+    seed_random(2);
+    hittable_list cluster;
+    for (int k = 0; k < cluster_size; ++k) {
+        point3 center(random_double(-0.5, 0.5), random_double(0.1, 0.9), random_double(-0.5, 0.5));
+        cluster.add(make_shared<sphere>(center, random_double(0.05, 0.15), 0));
+    }
+
+    std::vector<transform> placements;
+    auto place_copies = [&] {
+        placements.clear();
+        for (int i = 0; i < grid; ++i) {
+            for (int j = 0; j < grid; ++j) {
+                vec3 offset(-11 + 22.0 * (i + random_double()) / grid, 0, -11 + 22.0 * (j + random_double()) / grid);
+                placements.push_back(
+                    transform::translate(offset) * transform::rotate(vec3(0, 1, 0), random_double(0, 360)));
+            }
+        }
+    };
+
+    hittable_list flat_scene;
+    auto copy_flat = [&] {
+        flat_scene.clear();
+        for (const auto& to_world : placements) {
+            for (const auto& object : cluster.objects) {
+                auto s = static_cast<const sphere*>(object.get());
+                flat_scene.add(make_shared<sphere>(to_world.apply_point(s->center), s->radius, 0));
+            }
+        }
+    };
+
+    std::cout << "\n" << grid * grid << " copies of " << cluster_size << " spheres, flat against instanced\n"
+              << std::left << std::setw(14) << "structure" << std::right
+              << std::setw(10) << "build ms" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "MB"
+              << std::setw(10) << "move ms" << std::setw(10) << "hits" << '\n';
+
+    seed_random(3);
+    place_copies();
+    bytes_before = live_bytes.load();
+    begin = bench_clock::now();
+    copy_flat();
+    auto flat = std::make_unique<linear_bvh>(flat_scene, t0, t1);
+    auto flat_build_ms = elapsed_ms(begin);
+    auto flat_bytes = live_bytes.load() - bytes_before;
+
+    bytes_before = live_bytes.load();
+    begin = bench_clock::now();
+    auto shared_cluster = make_shared<linear_bvh>(cluster, t0, t1);
+    instance_bvh instances;
+    for (const auto& to_world : placements)
+        instances.add(shared_cluster, to_world, t0, t1);
+    instances.build();
+    auto instances_build_ms = elapsed_ms(begin);
+    auto instances_bytes = live_bytes.load() - bytes_before;
+
+    auto cluster_rays = make_rays(cam, *flat, width, height);
+    auto flat_result = trace(*flat, cluster_rays, repeat);
+    auto instances_result = trace(instances, cluster_rays, repeat);
+
+    place_copies();
+    begin = bench_clock::now();
+    copy_flat();
+    flat = std::make_unique<linear_bvh>(flat_scene, t0, t1);
+    auto flat_move_ms = elapsed_ms(begin);
+
+    begin = bench_clock::now();
+    for (uint32_t k = 0; k < placements.size(); ++k)
+        instances.set_transform(k, placements[k]);
+    instances.build();
+    auto instances_move_ms = elapsed_ms(begin);
+
+    for (auto row : {std::make_tuple("flat", flat_build_ms, flat_result, flat_bytes, flat_move_ms),
+                     std::make_tuple("instanced", instances_build_ms, instances_result, instances_bytes,
+                                     instances_move_ms)}) {
+        const auto& result = std::get<2>(row);
+        std::cout << std::left << std::setw(14) << std::get<0>(row) << std::right
+                  << std::setw(10) << std::get<1>(row) << std::setw(10) << result.ms
+                  << std::setw(10) << cluster_rays.size() / (result.ms * 1000.0)
+                  << std::setw(10) << std::get<3>(row) / 1048576.0
+                  << std::setw(10) << std::get<4>(row) << std::setw(10) << result.hits << '\n';
+    }
+
+    // Moving the ray into each copy's space rounds differently from moving the
+    // spheres out, so rays that graze a sphere may go either way.
+    if (std::abs(double(instances_result.hits) - double(flat_result.hits)) > 1e-4 * cluster_rays.size()) {
+        std::cerr << "instance_bvh disagrees with the flat copies\n";
+        return 1;
+    }
+
+    auto primary = make_primary_rays(cam, width / 2, height / 2);
+    std::cout << "\nprimary rays, linear sah, " << primary.size() << " rays, "
+              << simd_width << " SIMD lanes\n";
+
+    size_t single_hits;
+    auto single_rate = trace_primary(sah, primary, 0, single_hits);
+    std::cout << std::left << std::setw(14) << "single" << std::right
+              << std::setw(10) << single_rate << " Mrays/s\n";
+
+    for (int packet_size : {4, 8, 16}) {
+        size_t packet_hits;
+        auto rate = trace_primary(sah, primary, packet_size, packet_hits);
+        std::cout << std::left << std::setw(14) << ("packet " + std::to_string(packet_size))
+                  << std::right << std::setw(10) << rate << " Mrays/s"
+                  << std::setw(10) << rate / single_rate << "x\n";
+
+        if (packet_hits != single_hits) {
+            std::cerr << "packet tracing disagrees with single rays\n";
+            return 1;
+        }
+    }
+
+    // random_scene with heavy motion blur: every moving sphere travels three
+    // units during the shutter instead of half a unit.
+    seed_random(0);
+    material_table blur_materials;
+    auto blur_scene = random_scene(blur_materials, half_extent);
+    seed_random(5);
+    for (const auto& object : blur_scene.objects) {
+        if (auto m = dynamic_cast<moving_sphere*>(object.get()))
+            m->center1 = m->center0 + 3 * random_unit_vector();
+    }
+
+    begin = bench_clock::now();
+    linear_bvh swept(blur_scene, t0, t1);
+    auto swept_build_ms = elapsed_ms(begin);
+
+    begin = bench_clock::now();
+    motion_bvh motion(blur_scene, t0, t1);
+    auto motion_build_ms = elapsed_ms(begin);
+
+    auto blur_rays = make_rays(cam, swept, width, height);
+    std::cout << "\nrandom_scene(" << half_extent << ") with heavy motion blur, "
+              << blur_rays.size() << " rays\n"
+              << std::left << std::setw(14) << "structure" << std::right
+              << std::setw(10) << "build ms" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "nodes/ray"
+              << std::setw(10) << "prims/ray" << std::setw(10) << "hits" << '\n';
+
+    auto swept_result = trace(swept, blur_rays, repeat);
+    report("linear sah", swept_build_ms, swept_result, blur_rays.size());
+    auto motion_result = trace(motion, blur_rays, repeat);
+    report("motion", motion_build_ms, motion_result, blur_rays.size());
+
+    if (motion_result.hits != swept_result.hits) {
+        std::cerr << "motion_bvh disagrees with linear_bvh\n";
+        return 1;
+    }
+
+    // An animation of random_scene without its ground, in which every small
+    // sphere drifts along its own velocity, so the tree of the first frame fits
+    // worse and worse. Each frame the structure is rebuilt, refitted, or
+    // updated, which refits until the SAH cost has grown by half and then
+    // rebuilds. Times are per frame.
+    const int frames = 30;
+    seed_random(0);
+    material_table animated_materials;
+    auto ground_scene = random_scene(animated_materials, half_extent);
+    hittable_list animated_scene;
+
+    std::vector<point3*> movers; // centers, two for a moving_sphere
+    std::vector<point3> start;
+    std::vector<vec3> velocity;
+    seed_random(4);
+    for (const auto& object : ground_scene.objects) {
+        if (auto s = dynamic_cast<sphere*>(object.get())) {
+            if (s->radius >= 1000)
+                continue;
+            if (s->radius < 1)
+                movers.push_back(&s->center);
+        } else if (auto m = dynamic_cast<moving_sphere*>(object.get())) {
+            movers.push_back(&m->center0);
+            movers.push_back(&m->center1);
+        }
+        animated_scene.add(object);
+    }
+    for (auto center : movers) {
+        start.push_back(*center);
+        velocity.push_back(0.1 * random_in_unit_sphere());
+    }
+
+    auto animated_rays = make_primary_rays(cam, width / 4, height / 4);
+    std::cout << "\n" << frames << " frames of " << animated_scene.objects.size() - 3 << " moving spheres, "
+              << animated_rays.size() << " primary rays a frame\n"
+              << std::left << std::setw(14) << "each frame" << std::right
+              << std::setw(10) << "update ms" << std::setw(10) << "trace ms"
+              << std::setw(10) << "Mrays/s" << std::setw(10) << "cost" << std::setw(10) << "rebuilds"
+              << std::setw(10) << "hits" << '\n';
+
+    size_t rebuild_frame_hits = 0;
+    for (auto mode : {"rebuild", "refit", "update"}) {
+        for (size_t k = 0; k < movers.size(); ++k)
+            *movers[k] = start[k];
+        linear_bvh animated(animated_scene, t0, t1);
+
+        double update_ms = 0, trace_ms = 0;
+        size_t hits = 0;
+        int rebuilds = 0;
+        for (int frame = 1; frame <= frames; ++frame) {
+            for (size_t k = 0; k < movers.size(); ++k)
+                *movers[k] = start[k] + frame * velocity[k];
+
+            begin = bench_clock::now();
+            if (!strcmp(mode, "rebuild")) {
+                animated = linear_bvh(animated_scene, t0, t1);
+                rebuilds++;
+            } else if (!strcmp(mode, "refit")) {
+                animated.refit(t0, t1);
+            } else {
+                rebuilds += animated.update(t0, t1);
+            }
+            update_ms += elapsed_ms(begin);
+
+            auto result = trace(animated, animated_rays, 1);
+            trace_ms += result.ms;
+            hits += result.hits;
+        }
+
+        std::cout << std::left << std::setw(14) << mode << std::right
+                  << std::setw(10) << update_ms / frames << std::setw(10) << trace_ms / frames
+                  << std::setw(10) << animated_rays.size() * frames / (trace_ms * 1000.0)
+                  << std::setw(10) << bvh_sah_cost(animated.nodes) / animated.built_cost
+                  << std::setw(10) << rebuilds << std::setw(10) << hits << '\n';
+
+        if (!strcmp(mode, "rebuild"))
+            rebuild_frame_hits = hits;
+        else if (hits != rebuild_frame_hits) {
+            std::cerr << "a refitted linear_bvh disagrees with a rebuilt one\n";
+            return 1;
+        }
+    }
+}
@@ -3,8 +3,11 @@
 
 #include "rtweekend.h"
 #include "hittable.h"
+#include "arena.h"
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
+#include <algorithm>
+
+inline bool box_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b, int axis) {
     aabb box_a;
     aabb box_b;
 
@@ -14,15 +17,15 @@ inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable>
     return box_a.min().e[axis] < box_b.min().e[axis];
 }
 
-inline bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+inline bool box_x_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
     return box_compare(a, b, 0);
 }
 
-inline bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+inline bool box_y_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
     return box_compare(a, b, 1);
 }
 
-inline bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+inline bool box_z_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
     return box_compare(a, b, 2);
 }
 
@@ -30,17 +33,19 @@ class bvh_node : public hittable {
 public:
     bvh_node();
 
-    bvh_node(hittable_list& list, double time0, double time1)
-        : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+    // Inner nodes are allocated in storage when it is given.
+    bvh_node(hittable_list& list, real time0, real time1, arena* storage = nullptr)
+        : bvh_node(list.objects, 0, list.objects.size(), time0, time1, storage)
     {}
 
     bvh_node(
         std::vector<shared_ptr<hittable>>& objects,
-        size_t start, size_t end, double time0, double time1);
+        size_t start, size_t end, real time0, real time1, arena* storage = nullptr);
 
     virtual bool hit(
-        const ray& r, double tmin, double tmax, hit_record& rec) const override;
-    virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
 
 public:
     shared_ptr<hittable> left;
@@ -50,7 +55,7 @@ public:
 
 bvh_node::bvh_node(
     std::vector<shared_ptr<hittable>>& objects,
-    size_t start, size_t end, double time0, double time1
+    size_t start, size_t end, real time0, real time1, arena* storage
 ) {
     int axis = random_int(0, 2);
     auto comparator = (axis == 0) ? box_x_compare
@@ -73,8 +78,8 @@ bvh_node::bvh_node(
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
         auto mid = start + object_span/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        left = make_in<bvh_node>(storage, objects, start, mid, time0, time1, storage);
+        right = make_in<bvh_node>(storage, objects, mid, end, time0, time1, storage);
     }
 
     aabb box_left, box_right;
@@ -86,7 +91,8 @@ bvh_node::bvh_node(
     box = surrounding_box(box_left, box_right);
 }
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    add_count(counter::node_visits);
     if (!box.hit(r, t_min, t_max))
         return false;
 
@@ -96,7 +102,14 @@ bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     return hit_left || hit_right;
 }
 
-bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const {
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const {
+    add_count(counter::node_visits);
+    if (!box.hit(r, t_min, t_max))
+        return false;
+    return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
+bool bvh_node::bounding_box(real t0, real t1, aabb& output_box) const {
     output_box = box;
     return true;
 }
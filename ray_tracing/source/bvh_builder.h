@@ -0,0 +1,404 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One node of a flattened BVH. Nodes are stored in depth-first order, so the
+// first child of an interior node always follows it directly and only the
+// second child needs an explicit index. Bounds are kept in single precision,
+// rounded outwards, which packs a node into 32 bytes.
+struct linear_bvh_node {
+    float bounds_min[3];
+    uint32_t offset;          // leaf: first primitive, interior: second child
+    float bounds_max[3];
+    uint16_t primitive_count; // zero for interior nodes
+    uint8_t axis;             // split axis of interior nodes
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+// Deepest path the traversal stack has to hold. The builder falls back to
+// median splits well before this, so the stack can never overflow.
+const int bvh_max_depth = 128;
+
+inline float round_down(double x) {
+    auto f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up(double x) {
+    auto f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+struct bvh_build_options {
+    int bin_count = 16;
+    int max_leaf_size = 8;
+    double traversal_cost = 1.0;     // relative to one primitive test
+    int thread_count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    size_t parallel_threshold = 4096; // smallest range built on its own task
+    std::string cache_directory;      // of build_sah_bvh(), none if empty
+};
+
+// Builds a BVH with the Surface Area Heuristic. Primitive centroids are sorted
+// into bins along each axis, and the cheapest of the bin boundaries becomes the
+// split. A range turns into a leaf when no split is cheaper than intersecting
+// all of its primitives. Large subtrees are built in parallel.
+class sah_bvh_builder {
+public:
+    sah_bvh_builder(const bvh_build_options& opts = bvh_build_options()) : options(opts) {}
+
+    // Fills nodes and sets order so that leaf primitive i refers to input
+    // primitive order[i]. A primitive whose bounds are not finite stays in the
+    // tree, in a leaf that no ray reaches.
+    void build(
+        const std::vector<aabb>& bounds,
+        std::vector<linear_bvh_node>& nodes, std::vector<uint32_t>& order);
+
+private:
+    struct box3f {
+        float min[3];
+        float max[3];
+
+        void reset() {
+            for (int a = 0; a < 3; a++) {
+                min[a] = std::numeric_limits<float>::infinity();
+                max[a] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        void grow(const box3f& b) {
+            for (int a = 0; a < 3; a++) {
+                min[a] = std::min(min[a], b.min[a]);
+                max[a] = std::max(max[a], b.max[a]);
+            }
+        }
+
+        void grow(const float p[3]) {
+            for (int a = 0; a < 3; a++) {
+                min[a] = std::min(min[a], p[a]);
+                max[a] = std::max(max[a], p[a]);
+            }
+        }
+
+        float half_area() const {
+            auto dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+            return (dx < 0) ? 0 : dx*dy + dy*dz + dz*dx;
+        }
+    };
+
+    struct build_primitive {
+        box3f box;
+        float centroid[3];
+        uint32_t index;
+    };
+
+    struct build_node {
+        box3f box;
+        uint32_t first, count; // leaf range in primitives
+        int axis;
+        std::unique_ptr<build_node> children[2];
+    };
+
+    std::unique_ptr<build_node> build_range(uint32_t first, uint32_t last, int depth);
+    uint32_t partition_sah(uint32_t first, uint32_t last, const box3f& centroid_box, int& axis);
+    uint32_t flatten(const build_node& node, std::vector<linear_bvh_node>& nodes) const;
+
+private:
+    bvh_build_options options;
+    std::vector<build_primitive> primitives;
+};
+
+// Recomputes the bounds of a flattened BVH bottom-up for primitives that
+// have moved, keeping its topology. leaf_box(first, count) returns the box
+// around the primitives of one leaf. Children come after their parent in
+// depth-first order, so one pass from the back reaches every child first.
+template <typename LeafBox>
+void refit_bvh(std::vector<linear_bvh_node>& nodes, LeafBox&& leaf_box);
+
+// The expected cost of tracing a ray through the tree under the Surface Area
+// Heuristic, in primitive tests: every node is weighted by the chance that a
+// ray through the root also passes through it. A refitted tree keeps its
+// topology while the primitives move, so its cost grows against the cost it
+// had when built, and the ratio tells when a rebuild pays off.
+double bvh_sah_cost(const std::vector<linear_bvh_node>& nodes, double traversal_cost = 1.0);
+
+void sah_bvh_builder::build(
+    const std::vector<aabb>& bounds,
+    std::vector<linear_bvh_node>& nodes, std::vector<uint32_t>& order
+) {
+    nodes.clear();
+    order.clear();
+    if (bounds.empty())
+        return;
+
+    primitives.resize(bounds.size());
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        auto& p = primitives[i];
+        bool finite = true;
+        for (int a = 0; a < 3; a++) {
+            p.box.min[a] = round_down(bounds[i].min()[a]);
+            p.box.max[a] = round_up(bounds[i].max()[a]);
+            p.centroid[a] = 0.5f * p.box.min[a] + 0.5f * p.box.max[a];
+            finite = finite && std::isfinite(p.centroid[a]);
+        }
+        if (!finite) {
+            // NaN or infinite bounds would throw off the binning. The
+            // primitive gets an empty box instead, which no ray can enter.
+            p.box.reset();
+            for (int a = 0; a < 3; a++)
+                p.centroid[a] = 0;
+        }
+        p.index = static_cast<uint32_t>(i);
+    }
+
+    auto root = build_range(0, static_cast<uint32_t>(primitives.size()), 0);
+
+    nodes.reserve(2 * primitives.size());
+    flatten(*root, nodes);
+    nodes.shrink_to_fit();
+
+    order.resize(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        order[i] = primitives[i].index;
+
+    primitives.clear();
+    primitives.shrink_to_fit();
+}
+
+std::unique_ptr<sah_bvh_builder::build_node> sah_bvh_builder::build_range(
+    uint32_t first, uint32_t last, int depth
+) {
+    auto node = std::make_unique<build_node>();
+    node->box.reset();
+    node->first = first;
+    node->count = last - first;
+    node->axis = 0;
+
+    box3f centroid_box;
+    centroid_box.reset();
+    for (auto i = first; i < last; ++i) {
+        node->box.grow(primitives[i].box);
+        centroid_box.grow(primitives[i].centroid);
+    }
+
+    if (node->count == 1)
+        return node;
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (centroid_box.max[a] - centroid_box.min[a] > centroid_box.max[axis] - centroid_box.min[axis])
+            axis = a;
+    }
+
+    uint32_t mid = first;
+    auto is_leaf_sized = node->count <= static_cast<uint32_t>(options.max_leaf_size);
+
+    if (centroid_box.max[axis] > centroid_box.min[axis] && depth < bvh_max_depth / 2) {
+        mid = partition_sah(first, last, centroid_box, axis);
+        if ((mid == first || mid == last) && is_leaf_sized)
+            return node;
+    } else if (is_leaf_sized) {
+        return node;
+    }
+
+    if (mid == first || mid == last) {
+        // Every centroid coincides, or the tree is getting too deep: binning
+        // cannot help, so split the range in half.
+        mid = first + node->count / 2;
+        std::nth_element(
+            primitives.begin() + first, primitives.begin() + mid, primitives.begin() + last,
+            [axis](const build_primitive& a, const build_primitive& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    node->axis = axis;
+
+    if (node->count >= options.parallel_threshold && options.thread_count > 1
+        && depth < 8 && (1 << depth) < options.thread_count * 2) {
+        auto left = std::async(std::launch::async, [this, first, mid, depth] { return build_range(first, mid, depth + 1); });
+        node->children[1] = build_range(mid, last, depth + 1);
+        node->children[0] = left.get();
+    } else {
+        node->children[0] = build_range(first, mid, depth + 1);
+        node->children[1] = build_range(mid, last, depth + 1);
+    }
+
+    return node;
+}
+
+// Returns the split position, or first/last when a leaf is cheaper.
+uint32_t sah_bvh_builder::partition_sah(
+    uint32_t first, uint32_t last, const box3f& centroid_box, int& best_axis
+) {
+    const int bin_count = options.bin_count;
+
+    struct bin {
+        box3f box;
+        uint32_t count;
+    };
+    std::vector<bin> bins(3 * bin_count);
+    std::vector<float> right_area(bin_count), right_count(bin_count);
+
+    float scale[3];
+    for (int a = 0; a < 3; a++) {
+        auto extent = centroid_box.max[a] - centroid_box.min[a];
+        scale[a] = extent > 0 ? bin_count * (1 - 1e-6f) / extent : 0;
+        for (int b = 0; b < bin_count; b++) {
+            bins[a*bin_count + b].box.reset();
+            bins[a*bin_count + b].count = 0;
+        }
+    }
+
+    for (auto i = first; i < last; ++i) {
+        const auto& p = primitives[i];
+        for (int a = 0; a < 3; a++) {
+            auto b = static_cast<int>((p.centroid[a] - centroid_box.min[a]) * scale[a]);
+            auto& target = bins[a*bin_count + std::clamp(b, 0, bin_count - 1)];
+            target.box.grow(p.box);
+            target.count++;
+        }
+    }
+
+    box3f parent_box;
+    parent_box.reset();
+    for (int b = 0; b < bin_count; b++)
+        parent_box.grow(bins[b].box);
+
+    auto best_cost = std::numeric_limits<float>::infinity();
+    int best_bin = -1;
+    best_axis = 0;
+
+    for (int a = 0; a < 3; a++) {
+        if (scale[a] == 0)
+            continue;
+
+        // Sweep from the right to get the cost of every right-hand side, then
+        // from the left to combine it with the left-hand side.
+        box3f accum;
+        accum.reset();
+        uint32_t count = 0;
+        for (int b = bin_count - 1; b > 0; b--) {
+            accum.grow(bins[a*bin_count + b].box);
+            count += bins[a*bin_count + b].count;
+            right_area[b] = accum.half_area();
+            right_count[b] = static_cast<float>(count);
+        }
+
+        accum.reset();
+        count = 0;
+        for (int b = 0; b < bin_count - 1; b++) {
+            accum.grow(bins[a*bin_count + b].box);
+            count += bins[a*bin_count + b].count;
+            auto cost = accum.half_area() * count + right_area[b + 1] * right_count[b + 1];
+            if (count > 0 && right_count[b + 1] > 0 && cost < best_cost) {
+                best_cost = cost;
+                best_bin = b;
+                best_axis = a;
+            }
+        }
+    }
+
+    auto count = last - first;
+    auto parent_area = parent_box.half_area();
+    auto split_cost = options.traversal_cost + (parent_area > 0 ? best_cost / parent_area : 0);
+    auto leaf_cost = static_cast<double>(count);
+
+    if (best_bin < 0 || (count <= static_cast<uint32_t>(options.max_leaf_size) && split_cost >= leaf_cost))
+        return first;
+
+    auto axis = best_axis;
+    auto min = centroid_box.min[axis];
+    auto s = scale[axis];
+    auto split = std::partition(
+        primitives.begin() + first, primitives.begin() + last,
+        [=](const build_primitive& p) {
+            auto b = static_cast<int>((p.centroid[axis] - min) * s);
+            return std::min(b, bin_count - 1) <= best_bin;
+        });
+
+    return static_cast<uint32_t>(split - primitives.begin());
+}
+
+uint32_t sah_bvh_builder::flatten(const build_node& node, std::vector<linear_bvh_node>& nodes) const {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    auto& out = nodes[index];
+    for (int a = 0; a < 3; a++) {
+        out.bounds_min[a] = node.box.min[a];
+        out.bounds_max[a] = node.box.max[a];
+    }
+    out.axis = static_cast<uint8_t>(node.axis);
+    out.pad = 0;
+
+    if (!node.children[0]) {
+        out.offset = node.first;
+        out.primitive_count = static_cast<uint16_t>(node.count);
+        return index;
+    }
+
+    out.primitive_count = 0;
+    flatten(*node.children[0], nodes);
+    auto second = flatten(*node.children[1], nodes);
+    nodes[index].offset = second;
+
+    return index;
+}
+
+template <typename LeafBox>
+void refit_bvh(std::vector<linear_bvh_node>& nodes, LeafBox&& leaf_box) {
+    for (auto k = nodes.size(); k-- > 0; ) {
+        auto& node = nodes[k];
+        if (node.primitive_count > 0) {
+            aabb box = leaf_box(node.offset, uint32_t(node.primitive_count));
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min[a] = round_down(box.min()[a]);
+                node.bounds_max[a] = round_up(box.max()[a]);
+            }
+        } else {
+            const auto& first = nodes[k + 1];
+            const auto& second = nodes[node.offset];
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min[a] = std::min(first.bounds_min[a], second.bounds_min[a]);
+                node.bounds_max[a] = std::max(first.bounds_max[a], second.bounds_max[a]);
+            }
+        }
+    }
+}
+
+double bvh_sah_cost(const std::vector<linear_bvh_node>& nodes, double traversal_cost) {
+    if (nodes.empty())
+        return 0;
+
+    auto area = [](const linear_bvh_node& node) {
+        double d[3];
+        for (int a = 0; a < 3; a++)
+            d[a] = std::max(0.0, double(node.bounds_max[a]) - node.bounds_min[a]);
+        return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    };
+
+    auto root_area = area(nodes[0]);
+    if (root_area <= 0)
+        return 0;
+
+    double cost = 0;
+    for (const auto& node : nodes)
+        cost += area(node) * (node.primitive_count > 0 ? node.primitive_count : traversal_cost);
+    return cost / root_area;
+}
+
+#endif
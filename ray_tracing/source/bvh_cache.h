@@ -0,0 +1,208 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "bvh_builder.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Built BVHs kept on disk, so that a later run over the same primitives loads
+// the tree instead of building it again. What sah_bvh_builder makes depends
+// only on the primitive bounds and the build options, so their hash is the
+// key: the cache file of a tree is named after it and holds the nodes and the
+// primitive order of the build. Nodes refer to each other and to primitives by
+// index, so the file means the same wherever it is mapped.
+//
+// A file is used only if its header matches (magic, version, node layout, key
+// and primitive count), its size is right, the hash of its contents is the one
+// it was written with and every index in it is in range. Otherwise it is stale
+// or corrupt, and the tree is built as usual and written over it.
+
+// Builds like sah_bvh_builder(options).build(), through the cache in
+// options.cache_directory if there is one.
+void build_sah_bvh(
+    const std::vector<aabb>& bounds, const bvh_build_options& options,
+    std::vector<linear_bvh_node>& nodes, std::vector<uint32_t>& order);
+
+// A fast 64-bit hash for keys and checksums, not a cryptographic one. It goes
+// on from seed, so data in several pieces hashes like one block.
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0) {
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    auto p = static_cast<const unsigned char*>(data);
+    auto h = seed ^ (size * multiplier);
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = (h ^ word) * multiplier;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, size);
+    h = (h ^ tail) * multiplier;
+    return h ^ (h >> 29);
+}
+
+// File layout, little endian: the header, then node_count nodes and
+// primitive_count uint32_t of order.
+struct bvh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t key;
+    uint64_t primitive_count;
+    uint64_t node_count;
+    uint64_t checksum; // hash_bytes of the nodes, then of order
+};
+
+const char bvh_cache_magic[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+const uint32_t bvh_cache_version = 1;
+
+uint64_t bvh_cache_key(const std::vector<aabb>& bounds, const bvh_build_options& options) {
+    const uint64_t settings[] = {
+        bvh_cache_version, sizeof(real), bounds.size(),
+        static_cast<uint64_t>(options.bin_count), static_cast<uint64_t>(options.max_leaf_size)};
+    auto h = hash_bytes(settings, sizeof(settings));
+    h = hash_bytes(&options.traversal_cost, sizeof(options.traversal_cost), h);
+    return hash_bytes(bounds.data(), bounds.size() * sizeof(aabb), h);
+}
+
+std::string bvh_cache_path(const std::string& directory, uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+// Reads the tree of key over primitive_count primitives from path. Returns
+// false, with error empty if there is no such file or set if it cannot be
+// used.
+bool load_bvh_cache(
+    const std::string& path, uint64_t key, size_t primitive_count,
+    std::vector<linear_bvh_node>& nodes, std::vector<uint32_t>& order, std::string& error
+) {
+    error.clear();
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    bvh_cache_header header;
+    if (file.size() < sizeof(header)) {
+        error = "file is truncated";
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, bvh_cache_magic, sizeof(header.magic)) != 0
+        || header.version != bvh_cache_version || header.node_size != sizeof(linear_bvh_node)) {
+        error = "not a BVH cache file of this version";
+        return false;
+    }
+    if (header.key != key || header.primitive_count != primitive_count) {
+        error = "file is stale";
+        return false;
+    }
+
+    auto nodes_size = header.node_count * sizeof(linear_bvh_node);
+    auto order_size = header.primitive_count * sizeof(uint32_t);
+    if (header.node_count > file.size() / sizeof(linear_bvh_node)
+        || file.size() != sizeof(header) + nodes_size + order_size) {
+        error = "file has the wrong size";
+        return false;
+    }
+
+    auto node_data = file.data() + sizeof(header);
+    auto order_data = node_data + nodes_size;
+    if (hash_bytes(order_data, order_size, hash_bytes(node_data, nodes_size)) != header.checksum) {
+        error = "file is corrupt";
+        return false;
+    }
+
+    nodes.resize(header.node_count);
+    std::memcpy(nodes.data(), node_data, nodes_size);
+    order.resize(header.primitive_count);
+    std::memcpy(order.data(), order_data, order_size);
+
+    // A file that passes the checksum should be sound, but a traversal would
+    // run off the arrays if it were not, so the indices are checked as well.
+    bool sound = true;
+    for (size_t k = 0; k < nodes.size(); ++k) {
+        const auto& node = nodes[k];
+        if (node.primitive_count > 0)
+            sound = sound && size_t(node.offset) + node.primitive_count <= primitive_count;
+        else
+            sound = sound && node.offset > k + 1 && node.offset < nodes.size();
+    }
+    for (auto index : order)
+        sound = sound && index < primitive_count;
+    if (!sound) {
+        error = "file has indices out of range";
+        return false;
+    }
+    return true;
+}
+
+// Writes to a temporary file first and renames it over path, so a run killed
+// halfway through leaves no partial file behind.
+bool save_bvh_cache(
+    const std::string& path, uint64_t key,
+    const std::vector<linear_bvh_node>& nodes, const std::vector<uint32_t>& order
+) {
+    auto nodes_size = nodes.size() * sizeof(linear_bvh_node);
+    auto order_size = order.size() * sizeof(uint32_t);
+
+    bvh_cache_header header = {};
+    std::memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+    header.version = bvh_cache_version;
+    header.node_size = sizeof(linear_bvh_node);
+    header.key = key;
+    header.primitive_count = order.size();
+    header.node_count = nodes.size();
+    header.checksum = hash_bytes(order.data(), order_size, hash_bytes(nodes.data(), nodes_size));
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes_size);
+        out.write(reinterpret_cast<const char*>(order.data()), order_size);
+        if (!out) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void build_sah_bvh(
+    const std::vector<aabb>& bounds, const bvh_build_options& options,
+    std::vector<linear_bvh_node>& nodes, std::vector<uint32_t>& order
+) {
+    if (options.cache_directory.empty() || bounds.empty()) {
+        sah_bvh_builder(options).build(bounds, nodes, order);
+        return;
+    }
+
+    auto key = bvh_cache_key(bounds, options);
+    auto path = bvh_cache_path(options.cache_directory, key);
+    std::string error;
+    if (load_bvh_cache(path, key, bounds.size(), nodes, order, error))
+        return;
+    if (!error.empty())
+        std::cerr << "BVH cache: " << path << ": " << error << ", rebuilding.\n";
+
+    sah_bvh_builder(options).build(bounds, nodes, order);
+    if (!save_bvh_cache(path, key, nodes, order))
+        std::cerr << "BVH cache: cannot write " << path << '\n';
+}
+
+#endif
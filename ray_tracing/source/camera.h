@@ -9,12 +9,12 @@ public:
         point3 lookfrom,
         point3 lookat,
         vec3   vup,
-        double vfov, // vertical field-of-view in degrees
-        double aspect_ratio,
-        double aperture,
-        double focus_dist,
-        double t0 = 0,
-        double t1 = 0
+        real vfov, // vertical field-of-view in degrees
+        real aspect_ratio,
+        real aperture,
+        real focus_dist,
+        real t0 = 0,
+        real t1 = 0
     ) {
         auto theta = degrees_to_radians(vfov);
         auto h = tan(theta/2);
@@ -36,7 +36,7 @@ public:
         time1 = t1;
     }
 
-    ray get_ray(double s, double t) const {
+    ray get_ray(real s, real t) const {
         vec3 rd = lens_radius * random_in_unit_disk();
         vec3 offset = u * rd.x() + v * rd.y();
 
@@ -53,8 +53,8 @@ private:
     vec3 horizontal;
     vec3 vertical;
     vec3 u, v, w;
-    double lens_radius;
-    double time0, time1; // shutter open/close times
+    real lens_radius;
+    real time0, time1; // shutter open/close times
 };
 
 #endif
@@ -0,0 +1,132 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "framebuffer.h"
+#include "image_io.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+// The state of a progressive render, saved between passes so that a killed job
+// can pick up where it stopped.
+//
+// Every camera sample seeds its own generator from (seed, pixel, sample,
+// frame), see seed_sample, so the seed, the frame and the number of samples
+// already taken in each pixel are all of the random state there is. A resumed
+// render draws exactly the samples the interrupted one would have drawn next.
+struct render_checkpoint {
+    uint64_t seed = 0;
+    uint32_t frame = 0;
+    accumulation_buffer samples;
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+};
+
+// File layout, little endian: the header below, then counts (uint32_t per
+// pixel), sums (3 floats per pixel) and square_sums (1 float per pixel) as
+// stored in accumulation_buffer.
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;
+    uint32_t frame;
+    uint64_t seed;
+    uint32_t checksum; // crc32 of the pixel data
+    uint32_t pad;
+};
+
+const char checkpoint_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+const uint32_t checkpoint_version = 2;
+
+// Writes to a temporary file first and renames it over path, so a job killed
+// halfway through leaves the previous checkpoint intact.
+bool render_checkpoint::save(const std::string& path) const {
+    auto pixel_count = samples.counts.size();
+    auto counts_size = pixel_count * sizeof(uint32_t);
+    auto sums_size = pixel_count * 3 * sizeof(float);
+    auto square_sums_size = pixel_count * sizeof(float);
+
+    checkpoint_header header = {};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.width = samples.width;
+    header.height = samples.height;
+    header.frame = frame;
+    header.seed = seed;
+    header.checksum = crc32(reinterpret_cast<const char*>(samples.counts.data()), counts_size);
+    header.checksum = crc32(reinterpret_cast<const char*>(samples.sums.data()), sums_size, header.checksum);
+    header.checksum = crc32(
+        reinterpret_cast<const char*>(samples.square_sums.data()), square_sums_size, header.checksum);
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(samples.counts.data()), counts_size);
+        file.write(reinterpret_cast<const char*>(samples.sums.data()), sums_size);
+        file.write(reinterpret_cast<const char*>(samples.square_sums.data()), square_sums_size);
+        if (!file.flush()) {
+            std::cerr << "Cannot write " << temporary << '\n';
+            return false;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot replace " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+// Returns false if path cannot be read or does not hold an intact checkpoint.
+bool render_checkpoint::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    checkpoint_header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+
+    if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0
+        || header.version != checkpoint_version
+        || header.width <= 0 || header.height <= 0) {
+        std::cerr << path << " is not a checkpoint of this version\n";
+        return false;
+    }
+
+    // The size comes from the header, so the file must be checked to hold
+    // that many pixels before anything is allocated for them.
+    auto pixel_count = size_t(header.width) * size_t(header.height);
+    auto data_start = file.tellg();
+    file.seekg(0, std::ios::end);
+    auto data_size = size_t(file.tellg() - data_start);
+    file.seekg(data_start);
+    if (!file || data_size != pixel_count * (sizeof(uint32_t) + 4 * sizeof(float))) {
+        std::cerr << path << " is truncated or corrupt\n";
+        return false;
+    }
+
+    samples.resize(header.width, header.height);
+    auto counts_size = pixel_count * sizeof(uint32_t);
+    auto sums_size = pixel_count * 3 * sizeof(float);
+    auto square_sums_size = pixel_count * sizeof(float);
+    file.read(reinterpret_cast<char*>(samples.counts.data()), counts_size);
+    file.read(reinterpret_cast<char*>(samples.sums.data()), sums_size);
+    file.read(reinterpret_cast<char*>(samples.square_sums.data()), square_sums_size);
+
+    auto checksum = crc32(reinterpret_cast<const char*>(samples.counts.data()), counts_size);
+    checksum = crc32(reinterpret_cast<const char*>(samples.sums.data()), sums_size, checksum);
+    checksum = crc32(reinterpret_cast<const char*>(samples.square_sums.data()), square_sums_size, checksum);
+    if (!file || checksum != header.checksum) {
+        std::cerr << path << " is truncated or corrupt\n";
+        return false;
+    }
+
+    seed = header.seed;
+    frame = header.frame;
+    return true;
+}
+
+#endif
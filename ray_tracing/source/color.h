@@ -3,23 +3,17 @@
 
 #include "vec3.h"
 
-#include <iostream>
-
-void write_color(std::ostream& out, color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
+// Relative luminance of linear Rec. 709 radiance.
+inline real luminance(const color& c) {
+    return real(0.2126) * c.x() + real(0.7152) * c.y() + real(0.0722) * c.z();
+}
 
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(r * scale);
-    g = sqrt(g * scale);
-    b = sqrt(b * scale);
+// Maps linear radiance to an 8-bit display value with gamma 2.
+inline unsigned char to_display_byte(float linear) {
+    auto v = std::sqrt(linear > 0 ? double(linear) : 0.0);
 
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0, 0.999)) << '\n';
+    // Write the translated [0,255] value of the component.
+    return static_cast<unsigned char>(256 * clamp(v, 0, 0.999));
 }
 
 #endif
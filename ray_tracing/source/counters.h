@@ -0,0 +1,142 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Counts of the work done in the hot paths: the rays traced, the BVH nodes
+// they visit and the boxes and primitives they test. They are compiled in only
+// with RT_COUNTERS (the RAY_TRACING_COUNTERS option); otherwise add_count()
+// is empty and the hot paths are the same as without it.
+//
+// Every thread counts into counters of its own, without any synchronization,
+// and adds them to the shared totals when it ends. total_counters() adds the
+// counters of the calling thread, which is still running, to those.
+
+enum class counter : int {
+    camera_rays,
+    scatter_rays,
+    shadow_rays,
+    node_visits,     // bvh_node::hit and occluded calls, and flat BVH nodes
+    box_tests,       // aabb::hit calls and flat BVH node boxes, one per packet lane
+    primitive_tests, // spheres and triangles, one per SIMD lane for sphere_soa
+    count
+};
+
+const int counter_count = static_cast<int>(counter::count);
+
+struct ray_counters {
+    uint64_t values[counter_count] = {};
+
+    uint64_t& operator[](counter c) { return values[static_cast<int>(c)]; }
+    uint64_t operator[](counter c) const { return values[static_cast<int>(c)]; }
+
+    uint64_t rays() const {
+        return (*this)[counter::camera_rays] + (*this)[counter::scatter_rays] + (*this)[counter::shadow_rays];
+    }
+
+    // What the heatmap shows: every box and primitive test.
+    uint64_t cost() const { return (*this)[counter::box_tests] + (*this)[counter::primitive_tests]; }
+
+    ray_counters& operator+=(const ray_counters& other) {
+        for (int k = 0; k < counter_count; ++k)
+            values[k] += other.values[k];
+        return *this;
+    }
+
+    // The totals, and each count per ray traced.
+    void print(std::ostream& out) const;
+};
+
+#if RT_COUNTERS
+
+struct shared_counters {
+    std::mutex mutex;
+    ray_counters totals;
+};
+
+inline shared_counters& counter_totals() {
+    static shared_counters totals;
+    return totals;
+}
+
+struct thread_counters_owner {
+    ray_counters counters;
+
+    ~thread_counters_owner() {
+        auto& shared = counter_totals();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.totals += counters;
+    }
+};
+
+inline ray_counters& thread_counters() {
+    thread_local thread_counters_owner owner;
+    return owner.counters;
+}
+
+inline void add_count(counter c, uint64_t n = 1) {
+    thread_counters()[c] += n;
+}
+
+inline ray_counters total_counters() {
+    auto& shared = counter_totals();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    auto totals = shared.totals;
+    totals += thread_counters();
+    return totals;
+}
+
+#else
+
+inline void add_count(counter, uint64_t = 1) {}
+
+#endif
+
+void ray_counters::print(std::ostream& out) const {
+    static const char* names[counter_count] = {
+        "camera rays", "scatter rays", "shadow rays",
+        "node visits", "box tests", "primitive tests"};
+
+    auto ray_count = std::max<uint64_t>(rays(), 1);
+    for (int k = 0; k < counter_count; ++k) {
+        out << "  " << names[k] << ": " << values[k];
+        if (k >= static_cast<int>(counter::node_visits))
+            out << ", " << double(values[k]) / ray_count << " per ray";
+        out << '\n';
+    }
+}
+
+// Renders cost, one count per pixel in the storage order of framebuffer, as a
+// heat ramp from black through red and yellow to white. The ramp tops out at
+// the 99th percentile, so that a few extreme pixels do not leave the rest of
+// the image dark.
+void cost_heatmap(const std::vector<uint64_t>& cost, int width, int height, framebuffer& image) {
+    image.resize(width, height);
+    if (cost.empty())
+        return;
+
+    auto sorted = cost;
+    auto top = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), top, sorted.end());
+    auto scale = 1.0f / std::max<float>(float(*top), 1);
+
+    for (size_t k = 0; k < cost.size(); ++k) {
+        auto v = std::min(cost[k] * scale, 1.0f);
+        float rgb[3] = {
+            std::min(3 * v, 1.0f),
+            std::clamp(3 * v - 1, 0.0f, 1.0f),
+            std::clamp(3 * v - 2, 0.0f, 1.0f)};
+        // Squared so that the gamma 2 of the writers shows the ramp as is.
+        for (int c = 0; c < 3; c++)
+            image.pixels[3*k + c] = rgb[c] * rgb[c];
+    }
+}
+
+#endif
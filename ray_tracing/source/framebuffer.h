@@ -0,0 +1,124 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Linear radiance of an image, three floats per pixel. Rows are stored top
+// first, as image files expect, while pixel (i, j) follows the renderer with
+// j = 0 at the bottom row.
+class framebuffer {
+public:
+    framebuffer() {}
+    framebuffer(int w, int h) { resize(w, h); }
+
+    // Resizes the image and clears it to black.
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        pixels.assign(size_t(w) * h * 3, 0.0f);
+    }
+
+    void set(int i, int j, const color& c) {
+        auto p = &pixels[index(i, j)];
+        p[0] = static_cast<float>(c.x());
+        p[1] = static_cast<float>(c.y());
+        p[2] = static_cast<float>(c.z());
+    }
+
+    color get(int i, int j) const {
+        auto p = &pixels[index(i, j)];
+        return color(p[0], p[1], p[2]);
+    }
+
+    // Row y counted from the top, width rgb triples.
+    const float* row(int y) const { return &pixels[size_t(y) * width * 3]; }
+
+private:
+    size_t index(int i, int j) const {
+        return (size_t(height - 1 - j) * width + i) * 3;
+    }
+
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels;
+};
+
+// Running sums of the samples taken in every pixel, so an image can be built
+// up over several passes and resolved into a framebuffer at any point. Same
+// pixel order as framebuffer.
+class accumulation_buffer {
+public:
+    accumulation_buffer() {}
+    accumulation_buffer(int w, int h) { resize(w, h); }
+
+    // Resizes the buffer and drops every sample.
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        sums.assign(size_t(w) * h * 3, 0.0f);
+        square_sums.assign(size_t(w) * h, 0.0f);
+        counts.assign(size_t(w) * h, 0);
+    }
+
+    // Adds count samples whose radiance adds up to sum, and whose squared
+    // luminances add up to square_sum.
+    void add(int i, int j, const color& sum, real square_sum, uint32_t count) {
+        auto k = index(i, j);
+        sums[3*k + 0] += static_cast<float>(sum.x());
+        sums[3*k + 1] += static_cast<float>(sum.y());
+        sums[3*k + 2] += static_cast<float>(sum.z());
+        square_sums[k] += static_cast<float>(square_sum);
+        counts[k] += count;
+    }
+
+    uint32_t sample_count(int i, int j) const { return counts[index(i, j)]; }
+
+    // Mean luminance of pixel k, in storage order.
+    float mean_luminance(size_t k) const {
+        auto n = counts[k];
+        return n > 0 ? (0.2126f * sums[3*k] + 0.7152f * sums[3*k + 1] + 0.0722f * sums[3*k + 2]) / n : 0;
+    }
+
+    // Standard error of the mean luminance of pixel k, in storage order.
+    float standard_error(size_t k) const {
+        auto n = counts[k];
+        if (n < 2)
+            return std::numeric_limits<float>::infinity();
+        auto mean = mean_luminance(k);
+        auto variance = std::max(0.0f, square_sums[k] / n - mean * mean) * n / (n - 1);
+        return std::sqrt(variance / n);
+    }
+
+    uint32_t min_sample_count() const {
+        return counts.empty() ? 0 : *std::min_element(counts.begin(), counts.end());
+    }
+
+    // Writes the mean of every pixel, black where nothing was sampled yet.
+    void resolve(framebuffer& image) const {
+        image.resize(width, height);
+        for (size_t k = 0; k < counts.size(); ++k) {
+            auto scale = counts[k] > 0 ? 1.0f / counts[k] : 0.0f;
+            for (int c = 0; c < 3; c++)
+                image.pixels[3*k + c] = sums[3*k + c] * scale;
+        }
+    }
+
+    // Storage index of pixel (i, j), with j = 0 at the bottom.
+    size_t index(int i, int j) const { return size_t(height - 1 - j) * width + i; }
+
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<float> sums;        // rgb
+    std::vector<float> square_sums; // luminance squared
+    std::vector<uint32_t> counts;
+};
+
+#endif
@@ -5,25 +5,55 @@
 #include "ray.h"
 #include "aabb.h"
 
-class material;
+#include <cstdint>
+#include <type_traits>
+
+// Bound on the relative error of n rounded operations in real, gamma(n) in
+// Higham's notation.
+inline real rounding_error(int n) {
+    const auto eps = std::numeric_limits<real>::epsilon() / 2;
+    return (n * eps) / (1 - n * eps);
+}
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    real t;
+    real error; // distance within which p is guaranteed to lie of the surface
+    uint32_t material_id; // index into the scene's material_table
     bool front_face;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // Starts a ray at p, pushed along the normal just past the rounding error
+    // on the side that direction leaves through. The ray cannot hit the surface
+    // it starts on again, so it can be traced from t_min = 0 in float as well as
+    // in double, with no fixed epsilon that is too large for small objects and
+    // too small for large ones.
+    inline ray spawn_ray(const vec3& direction, real time) const {
+        auto offset = 2 * error * normal;
+        return ray(dot(direction, normal) > 0 ? p + offset : p - offset, direction, time);
+    }
 };
 
+// Copied for every candidate hit, so it must stay plain data.
+static_assert(std::is_trivially_copyable<hit_record>::value, "hit_record must be trivially copyable");
+
 class hittable {
 public:
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
-    virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const = 0;
+
+    // Whether r hits anything between t_min and t_max, for shadow rays. This
+    // finds the closest hit; structures that can stop at the first one they
+    // meet override it.
+    virtual bool occluded(const ray& r, real t_min, real t_max) const {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
 };
 
 #endif
@@ -18,14 +18,15 @@ public:
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
     virtual bool hit(
-        const ray& r, double tmin, double tmax, hit_record& rec) const override;
-    virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
 
 public:
     std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = t_max;
@@ -41,7 +42,15 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
     return hit_anything;
 }
 
-bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const {
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const {
+    for (const auto& object : objects) {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
+bool hittable_list::bounding_box(real t0, real t1, aabb& output_box) const {
     if (objects.empty()) return false;
 
     aabb temp_box;
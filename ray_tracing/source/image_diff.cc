@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Compares two renders, for example of the float and the double build:
+//
+//     cmake -S . -B build && cmake --build build
+//     cmake -S . -B build_float -DRAY_TRACING_FLOAT=ON && cmake --build build_float
+//     build/ray_tracing > double.ppm
+//     build_float/ray_tracing > float.ppm
+//     build/image_diff double.ppm float.ppm
+//
+// Reads the plain (P3) and binary (P6) PPM the renderer writes.
+
+struct image {
+    int width = 0;
+    int height = 0;
+    std::vector<int> values; // 3 per pixel, 0..max_value
+    int max_value = 255;
+};
+
+// Skips white space and # comments in a PPM header.
+void skip_space(std::istream& in) {
+    while (in) {
+        auto c = in.peek();
+        if (c == '#') {
+            std::string line;
+            std::getline(in, line);
+        } else if (std::isspace(c)) {
+            in.get();
+        } else {
+            break;
+        }
+    }
+}
+
+bool read_ppm(const char* path, image& img) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    in >> magic;
+    if (magic != "P3" && magic != "P6") {
+        std::cerr << path << ": not a P3 or P6 image\n";
+        return false;
+    }
+
+    skip_space(in);
+    in >> img.width;
+    skip_space(in);
+    in >> img.height;
+    skip_space(in);
+    in >> img.max_value;
+    if (!in || img.width <= 0 || img.height <= 0 || img.max_value <= 0 || img.max_value > 255) {
+        std::cerr << path << ": bad header\n";
+        return false;
+    }
+
+    img.values.resize(size_t(img.width) * img.height * 3);
+    if (magic == "P3") {
+        for (auto& v : img.values)
+            in >> v;
+    } else {
+        in.get();
+        std::vector<unsigned char> bytes(img.values.size());
+        in.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        std::copy(bytes.begin(), bytes.end(), img.values.begin());
+    }
+
+    if (!in) {
+        std::cerr << path << ": truncated\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int tolerance = 0;
+    const char* paths[2] = {nullptr, nullptr};
+    int path_count = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            auto value = argv[++i];
+            auto end = value + strlen(value);
+            auto result = std::from_chars(value, end, tolerance);
+            if (result.ec != std::errc() || result.ptr != end || tolerance < 0)
+                path_count = 3;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            path_count = 3;
+        }
+    }
+
+    if (path_count != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--tolerance N] a.ppm b.ppm\n";
+        return 1;
+    }
+
+    image a, b;
+    if (!read_ppm(paths[0], a) || !read_ppm(paths[1], b))
+        return 1;
+    if (a.width != b.width || a.height != b.height) {
+        std::cerr << "Images differ in size: " << a.width << 'x' << a.height
+                  << " and " << b.width << 'x' << b.height << '\n';
+        return 1;
+    }
+
+    double squared_sum = 0;
+    int max_difference = 0;
+    size_t differing_pixels = 0;
+    size_t pixel_count = size_t(a.width) * a.height;
+
+    for (size_t p = 0; p < pixel_count; ++p) {
+        int pixel_difference = 0;
+        for (int c = 0; c < 3; c++) {
+            auto d = std::abs(a.values[3*p + c] - b.values[3*p + c]);
+            squared_sum += double(d) * d;
+            pixel_difference = std::max(pixel_difference, d);
+        }
+        max_difference = std::max(max_difference, pixel_difference);
+        differing_pixels += pixel_difference > tolerance;
+    }
+
+    auto rmse = std::sqrt(squared_sum / (3.0 * pixel_count));
+    std::cout << std::fixed << std::setprecision(4)
+              << "rmse " << rmse << '\n'
+              << "psnr ";
+    if (rmse > 0)
+        std::cout << 20 * std::log10(a.max_value / rmse) << " dB\n";
+    else
+        std::cout << "inf\n";
+    std::cout << "max difference " << max_difference << '\n'
+              << "pixels differing by more than " << tolerance << ": " << differing_pixels
+              << " (" << 100.0 * differing_pixels / pixel_count << "%)\n";
+
+    return 0;
+}
@@ -0,0 +1,290 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Writers for a framebuffer. Every format is encoded into one memory buffer and
+// handed to the stream with a single write.
+//
+//   ppm  binary P6, 8 bits per channel, gamma 2
+//   png  8 bits per channel, gamma 2, stored (uncompressed) deflate blocks
+//   exr  linear half-float RGB, uncompressed scanlines
+
+enum class image_format { ppm, png, exr };
+
+inline bool parse_image_format(const std::string& name, image_format& format) {
+    if (name == "ppm") format = image_format::ppm;
+    else if (name == "png") format = image_format::png;
+    else if (name == "exr") format = image_format::exr;
+    else return false;
+    return true;
+}
+
+// Picks the format from the extension of path, or returns fallback.
+inline image_format image_format_from_path(const std::string& path, image_format fallback) {
+    auto dot = path.rfind('.');
+    image_format format;
+    if (dot != std::string::npos && parse_image_format(path.substr(dot + 1), format))
+        return format;
+    return fallback;
+}
+
+class image_encoder {
+public:
+    std::string encode(const framebuffer& image, image_format format);
+
+private:
+    void encode_ppm(const framebuffer& image);
+    void encode_png(const framebuffer& image);
+    void encode_exr(const framebuffer& image);
+
+    void put_u8(uint8_t v) { out.push_back(static_cast<char>(v)); }
+    void put_bytes(const void* data, size_t size) { out.append(static_cast<const char*>(data), size); }
+    void put_string(const char* s) { out.append(s, strlen(s) + 1); }
+    void put_u16_le(uint16_t v) { put_u8(v & 0xff); put_u8(v >> 8); }
+    void put_u32_le(uint32_t v) { put_u16_le(v & 0xffff); put_u16_le(v >> 16); }
+    void put_u64_le(uint64_t v) { put_u32_le(v & 0xffffffff); put_u32_le(v >> 32); }
+    void put_u32_be(uint32_t v) { for (int s = 24; s >= 0; s -= 8) put_u8((v >> s) & 0xff); }
+    void put_png_chunk(const char* type, const std::string& data);
+    void put_exr_attribute(const char* name, const char* type, const std::string& value);
+
+public:
+    std::string out;
+};
+
+// Converts to IEEE 754 binary16, rounding to nearest even.
+inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t biased = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+
+    if (biased == 0xff)
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+    int exponent = int(biased) - 127 + 15;
+    if (exponent >= 31)
+        return static_cast<uint16_t>(sign | 0x7c00);
+
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t h = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1)))
+            h++;
+        return static_cast<uint16_t>(sign | h);
+    }
+
+    // A carry out of the mantissa correctly rounds up into the exponent.
+    uint32_t h = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        h++;
+    return static_cast<uint16_t>(sign | h);
+}
+
+inline uint32_t crc32(const char* data, size_t size, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t;
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+std::string image_encoder::encode(const framebuffer& image, image_format format) {
+    out.clear();
+    switch (format) {
+    case image_format::ppm: encode_ppm(image); break;
+    case image_format::png: encode_png(image); break;
+    case image_format::exr: encode_exr(image); break;
+    }
+    return std::move(out);
+}
+
+void image_encoder::encode_ppm(const framebuffer& image) {
+    out += "P6\n" + std::to_string(image.width) + ' ' + std::to_string(image.height) + "\n255\n";
+    auto header_size = out.size();
+    out.resize(header_size + image.pixels.size());
+    for (size_t k = 0; k < image.pixels.size(); ++k)
+        out[header_size + k] = static_cast<char>(to_display_byte(image.pixels[k]));
+}
+
+void image_encoder::encode_png(const framebuffer& image) {
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    put_bytes(signature, sizeof(signature));
+
+    std::string header;
+    std::swap(out, header);
+    put_u32_be(image.width);
+    put_u32_be(image.height);
+    put_u8(8);  // bit depth
+    put_u8(2);  // color type: truecolor
+    put_u8(0);  // compression: deflate
+    put_u8(0);  // filter method
+    put_u8(0);  // no interlace
+    std::swap(out, header);
+    put_png_chunk("IHDR", header);
+
+    // Scanlines, each preceded by filter type 0.
+    const size_t stride = 1 + size_t(image.width) * 3;
+    std::string raw(image.height * stride, '\0');
+    for (int y = 0; y < image.height; ++y) {
+        auto row = image.row(y);
+        auto line = &raw[y * stride + 1];
+        for (int x = 0; x < image.width * 3; ++x)
+            line[x] = static_cast<char>(to_display_byte(row[x]));
+    }
+
+    // A zlib stream of stored deflate blocks. The renderer's output is noisy
+    // enough that real compression would mostly cost time.
+    std::string data;
+    std::swap(out, data);
+    put_u8(0x78);
+    put_u8(0x01);
+    const size_t max_block = 65535;
+    size_t pos = 0;
+    do {
+        auto size = std::min(max_block, raw.size() - pos);
+        put_u8(pos + size == raw.size() ? 1 : 0);
+        put_u16_le(static_cast<uint16_t>(size));
+        put_u16_le(static_cast<uint16_t>(~size));
+        put_bytes(raw.data() + pos, size);
+        pos += size;
+    } while (pos < raw.size());
+
+    // Adler-32, reducing only every 5552 bytes, the most b can take without
+    // overflowing 32 bits.
+    uint32_t a = 1, b = 0;
+    for (size_t begin = 0; begin < raw.size(); begin += 5552) {
+        auto end = std::min(raw.size(), begin + 5552);
+        for (auto i = begin; i < end; ++i) {
+            a += static_cast<uint8_t>(raw[i]);
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    put_u32_be((b << 16) | a);
+    std::swap(out, data);
+
+    put_png_chunk("IDAT", data);
+    put_png_chunk("IEND", std::string());
+}
+
+void image_encoder::put_png_chunk(const char* type, const std::string& data) {
+    put_u32_be(static_cast<uint32_t>(data.size()));
+    auto start = out.size();
+    put_bytes(type, 4);
+    out += data;
+    put_u32_be(crc32(out.data() + start, out.size() - start));
+}
+
+void image_encoder::encode_exr(const framebuffer& image) {
+    put_u32_le(20000630); // magic number
+    put_u32_le(2);        // version 2, single part scanline file
+
+    // Channels are listed, and stored, in alphabetical order.
+    std::string channels;
+    std::swap(out, channels);
+    for (auto name : {"B", "G", "R"}) {
+        put_string(name);
+        put_u32_le(1); // HALF
+        put_u32_le(0); // pLinear and reserved bytes
+        put_u32_le(1); // x sampling
+        put_u32_le(1); // y sampling
+    }
+    put_u8(0);
+    std::swap(out, channels);
+
+    std::string window;
+    std::swap(out, window);
+    put_u32_le(0);
+    put_u32_le(0);
+    put_u32_le(image.width - 1);
+    put_u32_le(image.height - 1);
+    std::swap(out, window);
+
+    float one = 1.0f;
+    std::string float_one(reinterpret_cast<const char*>(&one), sizeof(one));
+
+    put_exr_attribute("channels", "chlist", channels);
+    put_exr_attribute("compression", "compression", std::string(1, '\0'));
+    put_exr_attribute("dataWindow", "box2i", window);
+    put_exr_attribute("displayWindow", "box2i", window);
+    put_exr_attribute("lineOrder", "lineOrder", std::string(1, '\0')); // increasing y
+    put_exr_attribute("pixelAspectRatio", "float", float_one);
+    put_exr_attribute("screenWindowCenter", "v2f", std::string(8, '\0'));
+    put_exr_attribute("screenWindowWidth", "float", float_one);
+    put_u8(0);
+
+    // Offset table, one entry per scanline since nothing is compressed.
+    const uint32_t line_size = image.width * 3 * sizeof(uint16_t);
+    uint64_t offset = out.size() + uint64_t(image.height) * sizeof(uint64_t);
+    for (int y = 0; y < image.height; ++y) {
+        put_u64_le(offset);
+        offset += 8 + line_size;
+    }
+
+    out.reserve(offset);
+    for (int y = 0; y < image.height; ++y) {
+        put_u32_le(y);
+        put_u32_le(line_size);
+        auto row = image.row(y);
+        for (int c = 2; c >= 0; --c)
+            for (int x = 0; x < image.width; ++x)
+                put_u16_le(float_to_half(row[3*x + c]));
+    }
+}
+
+void image_encoder::put_exr_attribute(const char* name, const char* type, const std::string& value) {
+    put_string(name);
+    put_string(type);
+    put_u32_le(static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+// Writes the image to path, or to standard output when path is "-".
+bool write_image(const framebuffer& image, image_format format, const std::string& path) {
+    auto bytes = image_encoder().encode(image, format);
+
+    if (path == "-") {
+        std::cout.write(bytes.data(), bytes.size());
+        std::cout.flush();
+        return bool(std::cout);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(bytes.data(), bytes.size());
+    if (!file) {
+        std::cerr << "Cannot write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "transform.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// One placement of a shared object. The object, usually a triangle_mesh or a
+// linear_bvh, is traced in its own space: the ray is moved into it, and the hit
+// is moved back out. The direction is not renormalized, so t is the same in
+// both spaces. Any number of instances can refer to one object.
+class instance : public hittable {
+public:
+    instance() {}
+    instance(shared_ptr<const hittable> object, const transform& to_world, real time0 = 0, real time1 = 1);
+
+    void set_transform(const transform& to_world);
+
+    virtual bool hit(
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    aabb world_box() const { return to_world.apply_box(object_box); }
+
+public:
+    shared_ptr<const hittable> object;
+    transform to_world;
+    transform to_object;
+    aabb object_box; // of object over the shutter interval, kept for rebuilds
+};
+
+instance::instance(shared_ptr<const hittable> o, const transform& t, real time0, real time1)
+    : object(std::move(o)) {
+    object->bounding_box(time0, time1, object_box);
+    set_transform(t);
+}
+
+void instance::set_transform(const transform& t) {
+    to_world = t;
+    to_object = t.inverse();
+}
+
+bool instance::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+    if (!object->hit(local, t_min, t_max, rec))
+        return false;
+
+    // The error of p grows with the stretch of the transform, and the
+    // transform itself rounds three times per coordinate.
+    auto p = rec.p;
+    rec.p = to_world.apply_point(p);
+    real magnitude = 0;
+    for (int i = 0; i < 3; i++) {
+        magnitude = fmax(magnitude, fabs(to_world.m[i][0] * p.x()) + fabs(to_world.m[i][1] * p.y())
+                                  + fabs(to_world.m[i][2] * p.z()) + fabs(to_world.m[i][3]));
+    }
+    rec.error = (1 + rounding_error(3)) * to_world.max_stretch() * rec.error
+              + rounding_error(3) * magnitude;
+
+    // The normal already faces the local ray, and the inverse transpose keeps
+    // its sign against the transformed direction, so front_face carries over.
+    rec.normal = unit_vector(transform::apply_normal(to_object, rec.normal));
+    return true;
+}
+
+bool instance::occluded(const ray& r, real t_min, real t_max) const {
+    ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+    return object->occluded(local, t_min, t_max);
+}
+
+bool instance::bounding_box(real t0, real t1, aabb& output_box) const {
+    output_box = world_box();
+    return true;
+}
+
+// The top level of a two-level structure: a BVH over instances, each of which
+// refers to a bottom-level object with a BVH of its own. Memory follows the
+// unique geometry, plus a few hundred bytes per instance. Changing transforms
+// only needs the top level refitted or built again, which never touches the
+// objects below.
+class instance_bvh : public hittable {
+public:
+    instance_bvh() {}
+
+    // Returns the index of the instance, which build() does not change.
+    uint32_t add(shared_ptr<const hittable> object, const transform& to_world, real time0 = 0, real time1 = 1);
+    void set_transform(uint32_t index, const transform& to_world);
+
+    // Builds the top level. Must be called after the last add() or
+    // set_transform() and before the first hit().
+    void build(bvh_build_options options = bvh_build_options());
+
+    // Refits the top level after set_transform(), keeping its tree. Cheaper
+    // than build() for small moves, which loosen it.
+    void refit();
+
+    // Refits, or rebuilds once the refitted tree would cost more than
+    // max_cost_growth times what it cost when built. Returns whether it rebuilt.
+    bool update(double max_cost_growth = 1.5);
+
+    virtual bool hit(
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    size_t size() const { return instances.size(); }
+
+    // Bytes held by the instances and the top level, not by their objects.
+    size_t memory_usage() const;
+
+public:
+    std::vector<instance> instances;
+    std::vector<uint32_t> order; // leaf slot to instance index
+    std::vector<linear_bvh_node> nodes;
+    aabb box;
+    double built_cost = 0; // bvh_sah_cost() after the last build
+    bvh_build_options build_options;
+};
+
+uint32_t instance_bvh::add(shared_ptr<const hittable> object, const transform& to_world, real time0, real time1) {
+    instances.emplace_back(std::move(object), to_world, time0, time1);
+    return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void instance_bvh::set_transform(uint32_t index, const transform& to_world) {
+    instances[index].set_transform(to_world);
+}
+
+void instance_bvh::build(bvh_build_options options) {
+    nodes.clear();
+    order.clear();
+    if (instances.empty())
+        return;
+
+    std::vector<aabb> bounds(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        bounds[i] = instances[i].world_box();
+        box = i == 0 ? bounds[i] : surrounding_box(box, bounds[i]);
+    }
+
+    // Instances are few and each is a whole BVH below, so the leaves are kept
+    // small.
+    build_options = options;
+    options.max_leaf_size = std::min(options.max_leaf_size, 2);
+    build_sah_bvh(bounds, options, nodes, order);
+    built_cost = bvh_sah_cost(nodes);
+}
+
+void instance_bvh::refit() {
+    bool first_leaf = true;
+    refit_bvh(nodes, [&](uint32_t first, uint32_t count) {
+        aabb leaf_box = instances[order[first]].world_box();
+        for (auto i = first + 1; i < first + count; ++i)
+            leaf_box = surrounding_box(leaf_box, instances[order[i]].world_box());
+        box = first_leaf ? leaf_box : surrounding_box(box, leaf_box);
+        first_leaf = false;
+        return leaf_box;
+    });
+}
+
+bool instance_bvh::update(double max_cost_growth) {
+    refit();
+    if (bvh_sah_cost(nodes) <= max_cost_growth * built_cost)
+        return false;
+    build(build_options);
+    return true;
+}
+
+size_t instance_bvh::memory_usage() const {
+    return instances.capacity() * sizeof(instance)
+         + order.capacity() * sizeof(uint32_t)
+         + nodes.capacity() * sizeof(linear_bvh_node);
+}
+
+bool instance_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    no_traversal_stats stats;
+    return traverse_bvh(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            bool hit_anything = false;
+            for (auto i = first; i < first + count; ++i) {
+                if (instances[order[i]].hit(r, t_min, closest_so_far, rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+}
+
+bool instance_bvh::occluded(const ray& r, real t_min, real t_max) const {
+    no_traversal_stats stats;
+    return traverse_bvh<true>(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            for (auto i = first; i < first + count; ++i) {
+                if (instances[order[i]].occluded(r, t_min, closest_so_far))
+                    return true;
+            }
+            return false;
+        });
+}
+
+bool instance_bvh::bounding_box(real t0, real t1, aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+#endif
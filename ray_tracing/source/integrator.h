@@ -0,0 +1,164 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "light.h"
+#include "counters.h"
+
+#include <algorithm>
+
+// How far paths are followed. max_depth counts every ray of a path, camera ray
+// included, and the per bounce_type limits count bounces of one kind only.
+struct path_depths {
+    int max_depth = 50;
+    int bounce_limit[bounce_type_count] = {50, 50, 50}; // diffuse, glossy, transmission
+    int roulette_depth = 3; // rays traced before Russian roulette starts, -1 for never
+};
+
+// Where the last bounce of a path was, and the density with which it chose
+// the direction the path goes on in, zero after the camera or a bounce that
+// takes no light samples.
+struct bounce_origin {
+    point3 p;
+    real pdf;
+};
+
+inline real power_heuristic(real pdf, real other_pdf) {
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// Radiance emitted by an emissive material at rec toward the ray that found
+// it. Light that a bounce hits by chance could also have been sampled there,
+// so it is weighted against the light sample by multiple importance sampling.
+inline color emitted_light(
+    const material& mat, const light_list& lights, const hit_record& rec, const bounce_origin& from
+) {
+    auto emitted = mat.emitted(rec);
+    if (from.pdf <= 0)
+        return emitted;
+    auto light_pdf = lights.pdf(from.p, rec.material_id);
+    return light_pdf > 0 ? power_heuristic(from.pdf, light_pdf) * emitted : emitted;
+}
+
+// Shadow rays end this much short of the light, relative to its distance, so
+// that they do not hit the surface of a sphere light itself.
+const real shadow_margin = 1e-3;
+
+// A shadow ray, and the radiance it brings back if nothing blocks it.
+struct shadow_query {
+    ray r;
+    real t_max;
+    color radiance;
+};
+
+// Takes one light sample at rec, for a material that samples_lights().
+// Returns false when the light cannot reach the surface.
+inline bool sample_direct_light(
+    const material& mat, const light_list& lights, const ray& r_in, const hit_record& rec,
+    shadow_query& q
+) {
+    light_sample s;
+    if (!lights.sample(rec.p, s) || dot(s.direction, rec.normal) <= 0)
+        return false;
+
+    auto weight = s.is_delta ? 1 : power_heuristic(s.pdf, mat.pdf(rec, s.direction));
+    q.radiance = mat.evaluate(rec, s.direction) * s.radiance * (weight / s.pdf);
+    q.r = rec.spawn_ray(s.direction, r_in.time());
+    q.t_max = s.distance * (1 - shadow_margin);
+    return true;
+}
+
+// Traces paths with a loop instead of recursion, carrying the product of the
+// attenuations so far as the path throughput. Once a path is roulette_depth
+// rays long, it survives each further bounce with a probability equal to its
+// largest throughput component, capped at 0.95, and the survivors are divided
+// by that probability. Dim paths end early and the estimate stays unbiased.
+//
+// Lambertian bounces also sample one light and trace a shadow ray to it (next
+// event estimation). Light found both ways is combined with the power
+// heuristic, so small lights are found by the light samples and large ones by
+// scattering.
+class path_integrator {
+public:
+    path_integrator(
+        const hittable& w, const material_table& m, const light_list& l, const path_depths& d)
+        : world(w), materials(m), lights(l), depths(d) {}
+
+    // Radiance arriving along the camera ray r. segments is increased by the
+    // number of rays traced, shadow rays included.
+    color radiance(const ray& r, int& segments) const {
+        hit_record rec;
+        segments++;
+        add_count(counter::camera_rays);
+        if (!world.hit(r, 0, infinity, rec))
+            return lights.sky_radiance(r);
+        return radiance(r, rec, segments);
+    }
+
+    // Same, for a camera ray whose first hit rec was already found.
+    color radiance(ray r, hit_record rec, int& segments) const;
+
+public:
+    const hittable& world;
+    const material_table& materials;
+    const light_list& lights;
+    path_depths depths;
+};
+
+color path_integrator::radiance(ray r, hit_record rec, int& segments) const {
+    color throughput(1, 1, 1);
+    color result(0, 0, 0);
+    int bounces[bounce_type_count] = {};
+    bounce_origin from = {point3(), 0};
+
+    for (int depth = 1; ; ++depth) {
+        const auto& mat = materials[rec.material_id];
+        if (mat.type == material_type::diffuse_light)
+            result += throughput * emitted_light(mat, lights, rec, from);
+
+        // If we've exceeded the ray bounce limit, no more light is gathered.
+        if (depth >= depths.max_depth)
+            return result;
+
+        ray scattered;
+        color attenuation;
+        if (!mat.scatter(r, rec, attenuation, scattered))
+            return result;
+
+        auto type = static_cast<int>(mat.bounce());
+        if (++bounces[type] > depths.bounce_limit[type])
+            return result;
+
+        from = {rec.p, 0};
+        if (mat.samples_lights() && !lights.empty()) {
+            shadow_query q;
+            if (sample_direct_light(mat, lights, r, rec, q)) {
+                segments++;
+                add_count(counter::shadow_rays);
+                if (!world.occluded(q.r, 0, q.t_max))
+                    result += throughput * q.radiance;
+            }
+            from.pdf = mat.pdf(rec, unit_vector(scattered.direction()));
+        }
+
+        throughput = throughput * attenuation;
+
+        if (depths.roulette_depth >= 0 && depth >= depths.roulette_depth) {
+            auto survival = std::min<real>(
+                fmax(throughput.x(), fmax(throughput.y(), throughput.z())), real(0.95));
+            if (random_double() >= survival)
+                return result;
+            throughput /= survival;
+        }
+
+        r = scattered;
+        segments++;
+        add_count(counter::scatter_rays);
+        if (!world.hit(r, 0, infinity, rec))
+            return result + throughput * lights.sky_radiance(r);
+    }
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "rtweekend.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// The sky, seen along r. It lights the scene but is never sampled directly.
+inline color background(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direction());
+    auto t = 0.5*(unit_direction.y() + 1.0);
+    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+}
+
+enum class light_type : uint32_t { point, sphere };
+
+// A light that can be sampled from a point in the scene. Lights are plain data
+// like materials. A sphere light is the sampling side of a sphere of the scene
+// whose material is a diffuse_light, so paths can find it either way.
+struct light {
+    light_type type;
+    point3 position; // center of a sphere
+    real radius;     // sphere
+    color intensity; // point: radiant intensity, sphere: emitted radiance
+};
+
+// A direction toward a light, chosen from some point.
+struct light_sample {
+    vec3 direction;   // unit length
+    real distance;    // to the point on the light
+    color radiance;   // arriving along direction; for a point light, over distance squared
+    real pdf;         // per unit solid angle, including the choice of the light
+    bool is_delta;    // a point light, which no scattered ray can hit
+};
+
+// The lights of a scene. Lights are chosen uniformly, and a sphere light is
+// sampled uniformly over the cone of directions it subtends, which only wastes
+// samples on the part of the sphere hidden behind itself.
+class light_list {
+public:
+    void add_point(const point3& position, const color& intensity);
+
+    // The geometry is the caller's, a sphere with material_id, whose material
+    // must be diffuse_light(radiance).
+    void add_sphere(const point3& center, real radius, const color& radiance, uint32_t material_id);
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    // Samples a light as seen from p. Returns false if the chosen light cannot
+    // be seen from there at all.
+    bool sample(const point3& p, light_sample& s) const;
+
+    // The density sample() gives the direction from p to a point on the
+    // surface with material_id, zero for surfaces that are no light.
+    real pdf(const point3& p, uint32_t material_id) const;
+
+    color sky_radiance(const ray& r) const { return sky * background(r); }
+
+private:
+    // 1 - cos of the half angle of the cone a sphere subtends from a point at
+    // squared distance distance2 from its center, or zero from inside.
+    static real cone_width(real radius, real distance2);
+
+public:
+    std::vector<light> lights;
+    std::vector<int32_t> light_of_material; // -1 for materials of no light
+    real sky = 1; // scale of the background
+};
+
+void light_list::add_point(const point3& position, const color& intensity) {
+    lights.push_back({light_type::point, position, 0, intensity});
+}
+
+void light_list::add_sphere(const point3& center, real radius, const color& radiance, uint32_t material_id) {
+    if (light_of_material.size() <= material_id)
+        light_of_material.resize(material_id + 1, -1);
+    light_of_material[material_id] = static_cast<int32_t>(lights.size());
+    lights.push_back({light_type::sphere, center, radius, radiance});
+}
+
+real light_list::cone_width(real radius, real distance2) {
+    auto sin2_max = radius * radius / distance2;
+    if (sin2_max >= 1)
+        return 0;
+    // The same as 1 - cos_max, without the cancellation for distant lights.
+    return sin2_max / (1 + sqrt(1 - sin2_max));
+}
+
+bool light_list::sample(const point3& p, light_sample& s) const {
+    auto count = static_cast<int>(lights.size());
+    auto index = std::min(static_cast<int>(random_double() * count), count - 1);
+    const auto& l = lights[index];
+    auto to_light = l.position - p;
+    auto distance2 = to_light.length_squared();
+
+    if (l.type == light_type::point) {
+        s.distance = sqrt(distance2);
+        s.direction = to_light / s.distance;
+        s.radiance = l.intensity / distance2;
+        s.pdf = real(1) / count;
+        s.is_delta = true;
+        return true;
+    }
+
+    auto width = cone_width(l.radius, distance2);
+    if (width <= 0)
+        return false;
+
+    // A direction in the cone, around the axis w toward the center.
+    auto w = to_light / sqrt(distance2);
+    auto a = fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    auto v = unit_vector(cross(w, a));
+    auto u = cross(w, v);
+
+    auto cos_theta = 1 - random_double() * width;
+    auto sin_theta = sqrt(fmax(real(0), 1 - cos_theta * cos_theta));
+    auto phi = 2 * pi * random_double();
+    s.direction = unit_vector(sin_theta * cos(phi) * u + sin_theta * sin(phi) * v + cos_theta * w);
+
+    // The near intersection with the sphere, or the point of tangency for
+    // directions that graze it and miss by rounding.
+    auto along = dot(to_light, s.direction);
+    auto discriminant = along * along - (distance2 - l.radius * l.radius);
+    s.distance = along - sqrt(fmax(real(0), discriminant));
+
+    s.radiance = l.intensity;
+    s.pdf = 1 / (count * 2 * pi * width);
+    s.is_delta = false;
+    return true;
+}
+
+real light_list::pdf(const point3& p, uint32_t material_id) const {
+    if (material_id >= light_of_material.size() || light_of_material[material_id] < 0)
+        return 0;
+    const auto& l = lights[light_of_material[material_id]];
+    auto width = cone_width(l.radius, (l.position - p).length_squared());
+    return width > 0 ? 1 / (lights.size() * 2 * pi * width) : 0;
+}
+
+#endif
@@ -0,0 +1,561 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "bvh_builder.h"
+#include "bvh_cache.h"
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "simd.h"
+
+#include <cstdint>
+#include <vector>
+
+enum class bvh_split {
+    median, // bvh_node's random axis median split, flattened
+    sah     // binned Surface Area Heuristic, see sah_bvh_builder
+};
+
+// Counts the work done by one traversal, see linear_bvh::hit_counted.
+struct traversal_stats {
+    size_t nodes = 0;
+    size_t primitives = 0;
+
+    void visit_node() { nodes++; }
+    void test_primitive() { primitives++; }
+    void test_primitives(size_t n) { primitives += n; }
+};
+
+struct no_traversal_stats {
+    void visit_node() {}
+    void test_primitive() {}
+    void test_primitives(size_t) {}
+};
+
+// The box of a node, in single precision, for a ray at the given time. Node
+// types whose bounds change over the shutter overload this.
+struct node_box {
+    float min[3];
+    float max[3];
+};
+
+inline node_box bounds_at(const linear_bvh_node& node, float) {
+    return {{node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]},
+            {node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]}};
+}
+
+// Walks a flattened BVH for one ray, nearest child first, and calls
+// leaf(first, count, closest_so_far) for every leaf the ray reaches. The leaf
+// returns whether it found a hit, having lowered closest_so_far to it. With
+// any_hit the walk ends at the first leaf that finds one. Shared by every
+// structure built on linear_bvh_node or a node type with the same layout of
+// children and bounds_at().
+template <bool any_hit = false, typename Node, typename Stats, typename Leaf>
+bool traverse_bvh(
+    const Node* nodes, size_t node_count,
+    const ray& r, real t_min, real t_max, Stats& stats, Leaf&& leaf
+) {
+    if (node_count == 0)
+        return false;
+
+    float origin[3], inv_dir[3];
+    int dir_is_neg[3];
+    for (int a = 0; a < 3; a++) {
+        origin[a] = static_cast<float>(r.origin()[a]);
+        inv_dir[a] = static_cast<float>(r.inv_dir[a]);
+        dir_is_neg[a] = r.dir_is_neg[a];
+    }
+
+    // Widen the float interval a little so the conservative node bounds never
+    // cull a primitive that the scalar test would report. The far distance of
+    // every slab is widened too, by its own rounding error, or rays through
+    // the exact corner of a tight box, such as the vertex of a mesh, can miss.
+    const float slack = 1 + 4 * std::numeric_limits<float>::epsilon();
+    const float far_slack = 1 + 3 * std::numeric_limits<float>::epsilon();
+    auto tmin = static_cast<float>(t_min);
+    auto tmax = static_cast<float>(t_max) * slack;
+    auto time = static_cast<float>(r.time());
+
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    uint32_t stack[bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        stats.visit_node();
+        add_count(counter::node_visits);
+        add_count(counter::box_tests);
+        auto bounds = bounds_at(node, time);
+
+        auto t_near = tmin;
+        auto t_far = tmax;
+        bool overlap = true;
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (bounds.min[a] - origin[a]) * inv_dir[a];
+            auto t1 = (bounds.max[a] - origin[a]) * inv_dir[a];
+            if (dir_is_neg[a]) std::swap(t0, t1);
+            t1 *= far_slack;
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far = t1 < t_far ? t1 : t_far;
+            if (t_far < t_near) {
+                overlap = false;
+                break;
+            }
+        }
+
+        if (overlap) {
+            if (node.primitive_count > 0) {
+                if (leaf(node.offset, uint32_t(node.primitive_count), closest_so_far)) {
+                    if (any_hit)
+                        return true;
+                    hit_anything = true;
+                    tmax = static_cast<float>(closest_so_far) * slack;
+                }
+            } else {
+                // Visit the child on the near side of the split first.
+                if (dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+// Largest number of rays linear_bvh::hit_packet traces together.
+const int max_packet_size = 16;
+
+// Sphere and moving_sphere primitives are mirrored in single precision so
+// packets can test them across all lanes at once. center(t) is
+// center + t*velocity, which covers both kinds.
+struct packet_sphere {
+    float center[3];
+    float velocity[3];
+    float radius;
+    int32_t is_sphere; // zero for primitives that need a scalar hit()
+};
+
+class linear_bvh : public hittable {
+public:
+    linear_bvh() {}
+    linear_bvh(
+        hittable_list& list, real time0, real time1,
+        bvh_split split = bvh_split::sah,
+        const bvh_build_options& options = bvh_build_options());
+    linear_bvh(const bvh_node& root, real time0, real time1);
+
+    virtual bool hit(
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    // Bytes held by the node, primitive and packet arrays, not counting the
+    // primitives themselves.
+    size_t memory_usage() const;
+
+    // Refits the tree around the current bounds of the primitives, after they
+    // have moved, in a fraction of the time of a build.
+    void refit(real time0, real time1);
+
+    // Refits, or rebuilds with SAH once the refitted tree would cost more than
+    // max_cost_growth times what it cost when built. Returns whether it rebuilt.
+    bool update(real time0, real time1, double max_cost_growth = 1.5);
+
+    bool hit_counted(
+        const ray& r, real tmin, real tmax, hit_record& rec, traversal_stats& stats) const {
+        return traverse(r, tmin, tmax, rec, stats);
+    }
+
+    // Finds the closest hit of up to max_packet_size rays at once. The rays
+    // share one walk through the tree, with bounds and spheres tested across
+    // the packet in SIMD lanes. Works best when the rays are coherent, such
+    // as the camera samples of one pixel.
+    void hit_packet(
+        const ray* rays, int count, real tmin, real tmax,
+        hit_record* recs, bool* hits) const;
+
+private:
+    void mirror_spheres();
+
+    template <typename Stats>
+    bool traverse(const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats) const;
+
+    uint32_t flatten(const shared_ptr<hittable>& object, real time0, real time1);
+    uint32_t flatten_node(const bvh_node& node, real time0, real time1);
+    uint32_t add_leaf(const shared_ptr<hittable>& object, const aabb& box);
+    void set_bounds(linear_bvh_node& node, const aabb& box);
+
+public:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    std::vector<packet_sphere> spheres; // parallel to primitives
+    aabb box;
+    double built_cost = 0; // bvh_sah_cost() after the last build
+    bvh_build_options build_options;
+};
+
+linear_bvh::linear_bvh(
+    hittable_list& list, real time0, real time1,
+    bvh_split split, const bvh_build_options& options
+) {
+    if (split == bvh_split::median) {
+        *this = linear_bvh(bvh_node(list, time0, time1), time0, time1);
+        return;
+    }
+
+    std::vector<aabb> bounds(list.objects.size());
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        if (!list.objects[i]->bounding_box(time0, time1, bounds[i]))
+            std::cerr << "No bounding box in linear_bvh constructor.\n";
+    }
+    list.bounding_box(time0, time1, box);
+
+    std::vector<uint32_t> order;
+    build_sah_bvh(bounds, options, nodes, order);
+
+    primitives.reserve(order.size());
+    for (auto index : order)
+        primitives.push_back(list.objects[index]);
+
+    mirror_spheres();
+    built_cost = bvh_sah_cost(nodes);
+    build_options = options;
+}
+
+linear_bvh::linear_bvh(const bvh_node& root, real time0, real time1) {
+    box = root.box;
+    flatten_node(root, time0, time1);
+    mirror_spheres();
+    built_cost = bvh_sah_cost(nodes);
+}
+
+void linear_bvh::refit(real time0, real time1) {
+    bool first_leaf = true;
+    refit_bvh(nodes, [&](uint32_t first, uint32_t count) {
+        aabb leaf_box, object_box;
+        for (auto i = first; i < first + count; ++i) {
+            primitives[i]->bounding_box(time0, time1, object_box);
+            leaf_box = i == first ? object_box : surrounding_box(leaf_box, object_box);
+        }
+        box = first_leaf ? leaf_box : surrounding_box(box, leaf_box);
+        first_leaf = false;
+        return leaf_box;
+    });
+    mirror_spheres();
+}
+
+bool linear_bvh::update(real time0, real time1, double max_cost_growth) {
+    refit(time0, time1);
+    if (bvh_sah_cost(nodes) <= max_cost_growth * built_cost)
+        return false;
+
+    hittable_list list;
+    list.objects.swap(primitives);
+    *this = linear_bvh(list, time0, time1, bvh_split::sah, build_options);
+    return true;
+}
+
+uint32_t linear_bvh::flatten(const shared_ptr<hittable>& object, real time0, real time1) {
+    if (auto node = dynamic_cast<const bvh_node*>(object.get()))
+        return flatten_node(*node, time0, time1);
+
+    aabb object_box;
+    object->bounding_box(time0, time1, object_box);
+    return add_leaf(object, object_box);
+}
+
+uint32_t linear_bvh::flatten_node(const bvh_node& node, real time0, real time1) {
+    if (node.left == node.right)
+        return add_leaf(node.left, node.box);
+
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    set_bounds(nodes[index], node.box);
+
+    // bvh_node does not record its split axis, so take the axis along which
+    // the children are separated the most.
+    aabb box_left, box_right;
+    node.left->bounding_box(time0, time1, box_left);
+    node.right->bounding_box(time0, time1, box_right);
+    auto d = (box_right.min() + box_right.max()) - (box_left.min() + box_left.max());
+    nodes[index].axis = static_cast<uint8_t>(
+        fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2)
+                                  : (fabs(d.y()) > fabs(d.z()) ? 1 : 2));
+
+    flatten(node.left, time0, time1);
+    auto second = flatten(node.right, time0, time1);
+    nodes[index].offset = second;
+
+    return index;
+}
+
+uint32_t linear_bvh::add_leaf(const shared_ptr<hittable>& object, const aabb& box) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    set_bounds(nodes[index], box);
+    nodes[index].offset = static_cast<uint32_t>(primitives.size());
+    nodes[index].primitive_count = 1;
+    primitives.push_back(object);
+    return index;
+}
+
+void linear_bvh::set_bounds(linear_bvh_node& node, const aabb& box) {
+    for (int a = 0; a < 3; a++) {
+        node.bounds_min[a] = round_down(box.min()[a]);
+        node.bounds_max[a] = round_up(box.max()[a]);
+    }
+    node.offset = 0;
+    node.primitive_count = 0;
+    node.axis = 0;
+    node.pad = 0;
+}
+
+bool linear_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    no_traversal_stats stats;
+    return traverse(r, t_min, t_max, rec, stats);
+}
+
+bool linear_bvh::occluded(const ray& r, real t_min, real t_max) const {
+    no_traversal_stats stats;
+    return traverse_bvh<true>(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            for (auto i = first; i < first + count; ++i) {
+                if (primitives[i]->occluded(r, t_min, closest_so_far))
+                    return true;
+            }
+            return false;
+        });
+}
+
+template <typename Stats>
+bool linear_bvh::traverse(
+    const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats
+) const {
+    return traverse_bvh(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            bool hit_anything = false;
+            for (auto i = first; i < first + count; ++i) {
+                stats.test_primitive();
+                if (primitives[i]->hit(r, t_min, closest_so_far, rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+}
+
+void linear_bvh::mirror_spheres() {
+    spheres.assign(primitives.size(), packet_sphere());
+
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        auto& out = spheres[i];
+        point3 center, velocity;
+
+        if (auto s = dynamic_cast<const sphere*>(primitives[i].get())) {
+            center = s->center;
+            out.radius = static_cast<float>(s->radius);
+        } else if (auto m = dynamic_cast<const moving_sphere*>(primitives[i].get())) {
+            velocity = (m->center1 - m->center0) / (m->time1 - m->time0);
+            center = m->center0 - m->time0 * velocity;
+            out.radius = static_cast<float>(m->radius);
+        } else {
+            out.is_sphere = 0;
+            continue;
+        }
+
+        for (int a = 0; a < 3; a++) {
+            out.center[a] = static_cast<float>(center[a]);
+            out.velocity[a] = static_cast<float>(velocity[a]);
+        }
+        out.is_sphere = 1;
+    }
+}
+
+void linear_bvh::hit_packet(
+    const ray* rays, int count, real t_min, real t_max,
+    hit_record* recs, bool* hits
+) const {
+    const int lanes = (count + simd_width - 1) / simd_width * simd_width;
+
+    alignas(32) float origin[3][max_packet_size];
+    alignas(32) float dir[3][max_packet_size];
+    alignas(32) float inv_dir[3][max_packet_size];
+    alignas(32) float time[max_packet_size];
+    alignas(32) float closest[max_packet_size];
+    real closest_scalar[max_packet_size];
+    int32_t sphere_hit[max_packet_size];
+
+    const float slack = 1 + 4 * std::numeric_limits<float>::epsilon();
+    const auto far_slack = vfloat(1 + 3 * std::numeric_limits<float>::epsilon());
+    const auto tmin = vfloat(static_cast<float>(t_min));
+
+    for (int l = 0; l < lanes; ++l) {
+        // Padding lanes get an empty interval so they never report a hit.
+        const auto& r = rays[l < count ? l : 0];
+        for (int a = 0; a < 3; a++) {
+            origin[a][l] = static_cast<float>(r.origin()[a]);
+            dir[a][l] = static_cast<float>(r.direction()[a]);
+            inv_dir[a][l] = static_cast<float>(r.inv_dir[a]);
+        }
+        time[l] = static_cast<float>(r.time());
+        closest[l] = l < count ? static_cast<float>(t_max) * slack : -infinity;
+        closest_scalar[l] = t_max;
+        sphere_hit[l] = -1;
+        if (l < count) hits[l] = false;
+    }
+
+    if (nodes.empty())
+        return;
+
+    // Coherent rays agree on direction signs, so order children by the first ray.
+    int dir_is_neg[3];
+    for (int a = 0; a < 3; a++)
+        dir_is_neg[a] = inv_dir[a][0] < 0;
+
+    uint32_t stack[bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        add_count(counter::node_visits);
+
+        bool overlap = false;
+        for (int l = 0; l < lanes && !overlap; l += simd_width) {
+            add_count(counter::box_tests, simd_width);
+            auto t_near = tmin;
+            auto t_far = vfloat::load(closest + l);
+            for (int a = 0; a < 3; a++) {
+                auto o = vfloat::load(origin[a] + l);
+                auto inv = vfloat::load(inv_dir[a] + l);
+                auto t0 = (vfloat(node.bounds_min[a]) - o) * inv;
+                auto t1 = (vfloat(node.bounds_max[a]) - o) * inv;
+                t_near = vmax(vmin(t0, t1), t_near);
+                t_far = vmin(vmax(t0, t1) * far_slack, t_far);
+            }
+            overlap = any(t_near <= t_far);
+        }
+
+        if (overlap) {
+            if (node.primitive_count > 0) {
+                for (uint32_t i = 0; i < node.primitive_count; ++i) {
+                    auto index = node.offset + i;
+                    const auto& s = spheres[index];
+
+                    if (!s.is_sphere) {
+                        for (int l = 0; l < count; ++l) {
+                            auto limit = sphere_hit[l] < 0 ? closest_scalar[l] : real(closest[l]);
+                            if (primitives[index]->hit(rays[l], t_min, limit, recs[l])) {
+                                hits[l] = true;
+                                sphere_hit[l] = -1;
+                                closest_scalar[l] = recs[l].t;
+                                closest[l] = static_cast<float>(recs[l].t) * slack;
+                            }
+                        }
+                        continue;
+                    }
+
+                    for (int l = 0; l < lanes; l += simd_width) {
+                        add_count(counter::primitive_tests, simd_width);
+                        auto t = vfloat::load(time + l);
+                        vfloat oc[3], d[3];
+                        for (int a = 0; a < 3; a++) {
+                            auto c = vfloat(s.center[a]) + t * vfloat(s.velocity[a]);
+                            oc[a] = vfloat::load(origin[a] + l) - c;
+                            d[a] = vfloat::load(dir[a] + l);
+                        }
+
+                        // Hearn and Baker's form of the discriminant,
+                        // r^2 - |oc - (b/a)d|^2, keeps float accurate for
+                        // grazing rays where b^2 - ac cancels badly.
+                        auto qa = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+                        auto half_b = oc[0]*d[0] + oc[1]*d[1] + oc[2]*d[2];
+                        auto proj = half_b / qa;
+                        auto lx = oc[0] - proj*d[0];
+                        auto ly = oc[1] - proj*d[1];
+                        auto lz = oc[2] - proj*d[2];
+                        auto discriminant = vfloat(s.radius*s.radius) - (lx*lx + ly*ly + lz*lz);
+                        auto valid = discriminant > vfloat(0.0f);
+                        if (!any(valid))
+                            continue;
+
+                        auto root = vsqrt(vmax(discriminant, vfloat(0.0f)) / qa);
+                        auto far_limit = vfloat::load(closest + l);
+                        auto t0 = -proj - root;
+                        auto t1 = -proj + root;
+                        auto use0 = (t0 > tmin) & (t0 < far_limit);
+                        auto use1 = (t1 > tmin) & (t1 < far_limit);
+                        auto mask = movemask(valid & (use0 | use1));
+                        if (!mask)
+                            continue;
+
+                        alignas(32) float t_hit[simd_width];
+                        select(use0, t0, t1).store(t_hit);
+                        for (int k = 0; k < simd_width; ++k) {
+                            if (mask & (1 << k)) {
+                                closest[l + k] = t_hit[k];
+                                sphere_hit[l + k] = static_cast<int32_t>(index);
+                            }
+                        }
+                    }
+                }
+            } else {
+                if (dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    // Lanes whose closest hit is a sphere still need a full hit_record. The
+    // scalar test on that one primitive provides it; in the rare case that
+    // precision disagrees, the lane is traced again on its own. For rays that
+    // leave a surface, that includes a float root just past the origin, which
+    // culls every other primitive while the scalar test finds a root far beyond.
+    for (int l = 0; l < count; ++l) {
+        if (sphere_hit[l] < 0)
+            continue;
+        hits[l] = primitives[sphere_hit[l]]->hit(rays[l], t_min, closest_scalar[l], recs[l]);
+        if (!hits[l] || recs[l].t > real(closest[l]) * real(1.001))
+            hits[l] = hit(rays[l], t_min, t_max, recs[l]);
+    }
+}
+
+size_t linear_bvh::memory_usage() const {
+    return nodes.capacity() * sizeof(linear_bvh_node)
+         + primitives.capacity() * sizeof(shared_ptr<hittable>)
+         + spheres.capacity() * sizeof(packet_sphere);
+}
+
+bool linear_bvh::bounding_box(real t0, real t1, aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+#endif
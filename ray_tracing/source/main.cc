@@ -2,134 +2,536 @@
 
 #include "color.h"
 #include "hittable_list.h"
-#include "sphere.h"
-#include "moving_sphere.h"
 #include "camera.h"
 #include "material.h"
 #include "bvh.h"
+#include "linear_bvh.h"
+#include "scene.h"
+#include "scene_io.h"
+#include "renderer.h"
+#include "image_io.h"
+#include "checkpoint.h"
+#include "adaptive.h"
+#include "integrator.h"
+#include "wavefront.h"
+#include "mesh_io.h"
+#include "instance.h"
+#include "motion_bvh.h"
 
+#include <atomic>
 #include <iostream>
 #include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
 
-#define USE_BVH 1
+struct options {
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int tile_size = 16;
+    int image_width = 0;       // zero takes the scene's
+    int samples_per_pixel = 0; // zero takes the scene's
+    unsigned int seed = 0;
+    unsigned int frame = 0;
+    std::string accel = "sah";
+    int packet_size = 0;
+    std::string output = "-";
+    image_format format = image_format::ppm;
+    bool format_given = false;
+    int pass_samples = 0; // zero renders every sample in one pass
+    std::string preview;
+    std::string checkpoint;
+    float target_error = 0; // zero takes every sample in every pixel
+    int min_samples = 16;
+    std::string sample_map;
+    path_depths depths;
+    std::string engine = "megakernel";
+    std::string mesh;
+    int copies = 0;
+    bool lights = false;
+    std::string heatmap;
+    std::string scene;
+    std::string save_scene;
+    std::string bvh_cache;
+};
 
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
+bool parse_options(int argc, char* argv[], options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        auto has_value = i + 1 < argc;
 
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0, 0, 0);
+        if (!strcmp(argv[i], "--threads") && has_value) {
+            opts.threads = std::max(1, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--tile-size") && has_value) {
+            opts.tile_size = std::max(1, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--width") && has_value) {
+            opts.image_width = std::max(2, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--samples") && has_value) {
+            opts.samples_per_pixel = std::max(1, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--seed") && has_value) {
+            opts.seed = static_cast<unsigned int>(std::stoul(argv[++i]));
+        } else if (!strcmp(argv[i], "--accel") && has_value) {
+            opts.accel = argv[++i];
+            if (opts.accel != "list" && opts.accel != "bvh"
+                && opts.accel != "linear" && opts.accel != "sah" && opts.accel != "soa"
+                && opts.accel != "motion") {
+                std::cerr << "Unknown acceleration structure: " << opts.accel << '\n';
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--packet") && has_value) {
+            opts.packet_size = std::stoi(argv[++i]);
+            if (opts.packet_size != 0 && opts.packet_size != 4
+                && opts.packet_size != 8 && opts.packet_size != 16) {
+                std::cerr << "Packet size must be 0, 4, 8 or 16.\n";
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--output") && has_value) {
+            opts.output = argv[++i];
+        } else if (!strcmp(argv[i], "--format") && has_value) {
+            if (!parse_image_format(argv[++i], opts.format)) {
+                std::cerr << "Unknown image format: " << argv[i] << '\n';
+                return false;
+            }
+            opts.format_given = true;
+        } else if (!strcmp(argv[i], "--pass") && has_value) {
+            opts.pass_samples = std::max(0, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--preview") && has_value) {
+            opts.preview = argv[++i];
+        } else if (!strcmp(argv[i], "--checkpoint") && has_value) {
+            opts.checkpoint = argv[++i];
+        } else if (!strcmp(argv[i], "--adaptive") && has_value) {
+            opts.target_error = std::max(0.0f, std::stof(argv[++i]));
+        } else if (!strcmp(argv[i], "--min-samples") && has_value) {
+            opts.min_samples = std::max(2, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--sample-map") && has_value) {
+            opts.sample_map = argv[++i];
+        } else if (!strcmp(argv[i], "--max-depth") && has_value) {
+            opts.depths.max_depth = std::max(1, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--diffuse-depth") && has_value) {
+            opts.depths.bounce_limit[int(bounce_type::diffuse)] = std::max(0, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--glossy-depth") && has_value) {
+            opts.depths.bounce_limit[int(bounce_type::glossy)] = std::max(0, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--transmission-depth") && has_value) {
+            opts.depths.bounce_limit[int(bounce_type::transmission)] = std::max(0, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--roulette-depth") && has_value) {
+            opts.depths.roulette_depth = std::max(-1, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--engine") && has_value) {
+            opts.engine = argv[++i];
+            if (opts.engine != "megakernel" && opts.engine != "wavefront") {
+                std::cerr << "Unknown engine: " << opts.engine << '\n';
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--mesh") && has_value) {
+            opts.mesh = argv[++i];
+        } else if (!strcmp(argv[i], "--lights")) {
+            opts.lights = true;
+        } else if (!strcmp(argv[i], "--copies") && has_value) {
+            opts.copies = std::max(0, std::stoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--scene") && has_value) {
+            opts.scene = argv[++i];
+        } else if (!strcmp(argv[i], "--save-scene") && has_value) {
+            opts.save_scene = argv[++i];
+        } else if (!strcmp(argv[i], "--bvh-cache") && has_value) {
+            opts.bvh_cache = argv[++i];
+        } else if (!strcmp(argv[i], "--heatmap") && has_value) {
+            opts.heatmap = argv[++i];
+        } else if (!strcmp(argv[i], "--frame") && has_value) {
+            opts.frame = static_cast<unsigned int>(std::stoul(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--threads N] [--tile-size N] [--width N] [--samples N] [--seed N] [--frame N]"
+                      << " [--accel list|bvh|linear|sah|soa|motion] [--packet 0|4|8|16]"
+                      << " [--format ppm|png|exr] [--output FILE]"
+                      << " [--pass N] [--preview FILE] [--checkpoint FILE]"
+                      << " [--adaptive ERROR] [--min-samples N] [--sample-map FILE]"
+                      << " [--max-depth N] [--diffuse-depth N] [--glossy-depth N] [--transmission-depth N]"
+                      << " [--roulette-depth N] [--engine megakernel|wavefront] [--mesh FILE]"
+                      << " [--copies N] [--lights] [--heatmap FILE] [--scene FILE] [--save-scene FILE]"
+                      << " [--bvh-cache DIR]\n"
+                      << "Writes to standard output unless --output is given. The format defaults to\n"
+                      << "the extension of the output file, or ppm.\n"
+                      << "--pass N renders N samples per pixel at a time. After every pass the image\n"
+                      << "so far goes to the --preview file and the samples to the --checkpoint file.\n"
+                      << "An existing checkpoint is resumed.\n"
+                      << "--adaptive ERROR stops sampling a pixel once the standard error of its\n"
+                      << "display value is below ERROR (1/256 is one 8-bit step), after at least\n"
+                      << "--min-samples. --samples is then the most any pixel gets.\n"
+                      << "Paths trace at most --max-depth rays (50), and Russian roulette may end them\n"
+                      << "once they are --roulette-depth rays long (3, -1 never).\n"
+                      << "--accel motion keeps BVH bounds at both ends of the shutter and tests the\n"
+                      << "box at each ray's time, which pays off with heavy motion blur.\n"
+                      << "--engine wavefront traces all the paths of a tile one bounce at a time,\n"
+                      << "sorted by direction and material, instead of one path at a time.\n"
+                      << "--mesh FILE puts an OBJ or binary PLY mesh in place of the glass sphere.\n"
+                      << "--copies N also scatters N smaller instances of it over the ground, which\n"
+                      << "all share its vertices and BVH.\n"
+                      << "--lights dims the sky and lights the scene with small spheres and a point\n"
+                      << "light, which diffuse bounces sample with shadow rays.\n"
+                      << "--heatmap FILE writes the box and primitive tests of every pixel as an\n"
+                      << "image. It needs a build with RAY_TRACING_COUNTERS and the megakernel.\n"
+                      << "--scene FILE renders a scene file instead of the random scene, and\n"
+                      << "--save-scene FILE writes the scene out as one and exits, in the binary form\n"
+                      << "if FILE ends in .rtb. --width and --samples override those of the file.\n"
+                      << "--bvh-cache DIR keeps the SAH trees it builds in DIR, keyed by the bounds\n"
+                      << "of their primitives, and loads them from there when they come up again.\n";
+            return false;
+        }
+    }
 
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth-1);
-        return color(0, 0, 0);
+    if (!opts.format_given)
+        opts.format = image_format_from_path(opts.output, image_format::ppm);
+
+    if (!opts.scene.empty() && opts.lights) {
+        std::cerr << "--lights applies to the random scene only.\n";
+        return false;
     }
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5*(unit_direction.y() + 1.0);
-    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
-}
 
-hittable_list random_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(make_shared<moving_sphere>(
-                        center, center2, 0.0, 1.0, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+    if (!opts.heatmap.empty()) {
+#if !RT_COUNTERS
+        std::cerr << "--heatmap needs a build with RAY_TRACING_COUNTERS\n";
+        return false;
+#endif
+        // The wavefront engine traces many pixels at once, so its work cannot
+        // be told apart by pixel.
+        if (opts.engine != "megakernel") {
+            std::cerr << "--heatmap needs --engine megakernel\n";
+            return false;
         }
     }
+    return true;
+}
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+int main(int argc, char* argv[]) {
+    options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    // Scene
+    seed_random(opts.seed);
 
-    return world;
-}
+    scene_description description;
+    if (!opts.scene.empty()) {
+        auto begin = std::chrono::steady_clock::now();
+        if (!load_scene(opts.scene, description))
+            return 1;
+        auto loaded = std::chrono::steady_clock::now();
+        std::cerr << "Scene file: " << description.spheres.size() << " spheres, "
+                  << description.meshes.size() << " meshes, loaded in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(loaded - begin).count() << "ms.\n";
+    } else {
+        description = random_scene_description(11, opts.mesh.empty(), opts.lights);
+    }
 
-int main() {
+    if (!opts.mesh.empty()) {
+        auto begin = std::chrono::steady_clock::now();
+        auto m = static_cast<uint32_t>(description.materials.size());
+        description.materials.push_back(metal(color(0.8, 0.6, 0.4), 0.1));
+        scene_mesh mesh = {m, opts.mesh, point3(0, 0, 0), 2, {}, {}};
+        if (!load_scene_mesh(mesh, std::string()))
+            return 1;
+        description.meshes.push_back(std::move(mesh));
+        auto loaded = std::chrono::steady_clock::now();
+        std::cerr << "Mesh: loaded in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(loaded - begin).count() << "ms.\n";
+    }
 
     // Image
-    const auto aspect_ratio = 16.0 / 9.0;
-    const int image_width = 400;
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 100;
-    const int max_depth = 50;
+    if (opts.image_width > 0) {
+        // Pixel coordinates divide by the height less one, so the image needs
+        // two rows at the aspect ratio of the scene.
+        description.image_width = opts.image_width;
+        while (description.image_height() < 2)
+            ++description.image_width;
+    }
+    if (opts.samples_per_pixel > 0)
+        description.samples_per_pixel = opts.samples_per_pixel;
+    const int image_width = description.image_width;
+    const int image_height = description.image_height();
+    const int samples_per_pixel = description.samples_per_pixel;
+
+    if (!opts.save_scene.empty()) {
+        if (!save_scene(opts.save_scene, description))
+            return 1;
+        std::cerr << "Scene written to " << opts.save_scene << ".\n";
+        return 0;
+    }
 
     // World
-    float t0 = 0.0, t1 = 1.0;
+    const real t0 = description.time0, t1 = description.time1;
+    auto world_begin = std::chrono::steady_clock::now();
 
-#if USE_BVH
-    hittable_list scene = random_scene();
-    bvh_node world = bvh_node(scene, t0, t1);
-#else
-    hittable_list world = random_scene();
-#endif
+    bvh_build_options build_options;
+    if (!opts.bvh_cache.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(opts.bvh_cache, error);
+        if (error) {
+            std::cerr << "Cannot create " << opts.bvh_cache << ": " << error.message() << '\n';
+            return 1;
+        }
+        build_options.cache_directory = opts.bvh_cache;
+    }
 
-    // Camera
-    point3 lookfrom(13,2,3);
-    point3 lookat(0,0,0);
-    vec3 vup(0,1,0);
-    auto dist_to_focus = 10.0;
-    auto aperture = 0.1;
+    // Declared first, so that it outlives the objects allocated in it.
+    arena scene_arena;
+    material_table materials;
+    light_list lights;
+    hittable_list scene;
+    shared_ptr<hittable> accel;
+
+    if (opts.accel == "soa" && !description.meshes.empty()) {
+        std::cerr << "--accel soa holds spheres only and cannot take a mesh.\n";
+        return 1;
+    }
+
+    if (opts.accel == "soa") {
+        auto soa = make_shared<sphere_soa>();
+        sphere_soa_builder builder{*soa, materials};
+        build_scene(description, builder, lights);
+        soa->build(t0, t1, build_options);
+        accel = soa;
+    } else {
+        hittable_list_builder builder{scene, materials, &scene_arena};
+        build_scene(description, builder, lights);
+    }
+
+    size_t mesh_bytes = 0;
+    for (auto& m : description.meshes) {
+        auto begin = std::chrono::steady_clock::now();
+        auto mesh = scene_arena.make<triangle_mesh>();
+        mesh->positions = std::move(m.positions);
+        mesh->indices = std::move(m.indices);
+        mesh->material_id = m.material;
+        mesh->build(build_options);
+        mesh_bytes += mesh->memory_usage();
+        auto built = std::chrono::steady_clock::now();
+
+        std::cerr << "Mesh: " << mesh->triangle_count() << " triangles, " << mesh->positions.size()
+                  << " vertices, BVH built in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(built - begin).count()
+                  << "ms.\n";
+
+        if (opts.copies == 0) {
+            scene.add(mesh);
+        } else {
+            begin = std::chrono::steady_clock::now();
+            auto instances = scene_arena.make<instance_bvh>();
+            instances->add(mesh, transform());
+            scatter_instances(*instances, mesh, opts.copies, 11, t0, t1);
+            instances->build(build_options);
+            scene.add(instances);
+            mesh_bytes += instances->memory_usage();
+            auto placed = std::chrono::steady_clock::now();
+
+            std::cerr << "Instances: " << instances->size() << ", top level built in "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(placed - begin).count() / 1000.0
+                      << "ms, " << mesh_bytes / 1048576.0 << " MB against "
+                      << instances->size() * mesh->memory_usage() / 1048576.0
+                      << " MB for separate meshes.\n";
+        }
+    }
+
+    if (opts.accel == "bvh")
+        accel = scene_arena.make<bvh_node>(scene, t0, t1, &scene_arena);
+    else if (opts.accel == "linear")
+        accel = make_shared<linear_bvh>(scene, t0, t1, bvh_split::median);
+    else if (opts.accel == "sah")
+        accel = make_shared<linear_bvh>(scene, t0, t1, bvh_split::sah, build_options);
+    else if (opts.accel == "motion")
+        accel = make_shared<motion_bvh>(scene, t0, t1, build_options);
+
+    auto world_end = std::chrono::steady_clock::now();
+    std::cerr << "World built in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(world_end - world_begin).count() << "ms.\n";
+
+    const hittable& world = accel ? *accel : scene;
 
-    camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus, t0, t1);
+    size_t scene_bytes = scene_arena.bytes_reserved() + mesh_bytes
+                       + scene.objects.capacity() * sizeof(shared_ptr<hittable>)
+                       + materials.materials.capacity() * sizeof(material);
+    if (auto soa = dynamic_cast<const sphere_soa*>(accel.get()))
+        scene_bytes += soa->memory_usage();
+    else if (auto tree = dynamic_cast<const linear_bvh*>(accel.get()))
+        scene_bytes += tree->memory_usage();
+    else if (auto motion = dynamic_cast<const motion_bvh*>(accel.get()))
+        scene_bytes += motion->memory_usage();
+    std::cerr << "Scene: " << materials.size() << " materials, "
+              << scene_bytes / 1048576.0 << " MB\n";
+
+    auto packet_world = dynamic_cast<const linear_bvh*>(accel.get());
+    if (opts.packet_size > 0 && !packet_world) {
+        std::cerr << "Packet tracing needs --accel linear or sah.\n";
+        return 1;
+    }
+
+    // Camera
+    camera cam = description.make_camera();
 
     // Render
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    render_checkpoint state;
+    state.seed = opts.seed;
+    state.frame = opts.frame;
+    state.samples.resize(image_width, image_height);
+
+    if (!opts.checkpoint.empty() && std::ifstream(opts.checkpoint)) {
+        render_checkpoint saved;
+        if (!saved.load(opts.checkpoint))
+            return 1;
+        if (saved.seed != state.seed || saved.frame != state.frame
+            || saved.samples.width != image_width || saved.samples.height != image_height) {
+            std::cerr << opts.checkpoint << " belongs to a different render.\n";
+            return 1;
+        }
+        state = std::move(saved);
+        std::cerr << "Resuming " << opts.checkpoint << " at "
+                  << state.samples.min_sample_count() << " samples per pixel.\n";
+    }
+
+    auto& samples = state.samples;
+    const bool adaptive = opts.target_error > 0;
+    const int min_samples = std::min(opts.min_samples, samples_per_pixel);
+    const int pass_samples = opts.pass_samples > 0 ? opts.pass_samples
+                           : adaptive ? min_samples : samples_per_pixel;
+    adaptive_sampler sampler(
+        opts.target_error, adaptive ? min_samples : std::min(pass_samples, samples_per_pixel),
+        samples_per_pixel);
+    framebuffer image;
+
+    path_integrator integrator(world, materials, lights, opts.depths);
+    wavefront_integrator wavefront(
+        world, materials, lights, cam, opts.depths, image_width, image_height, opts.seed, opts.frame,
+        packet_world, opts.packet_size);
+    std::atomic<uint64_t> path_count(0), segment_count(0);
+    // Box and primitive tests per pixel, in the storage order of samples.
+    std::vector<uint64_t> pixel_cost(opts.heatmap.empty() ? 0 : samples.counts.size());
 
     auto begin = std::chrono::steady_clock::now();
 
-    for (int j = image_height-1; j >=0 ;--j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i+random_double()) / (image_width-1);
-                auto v = (j+random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
-            }
-            write_color(std::cout, pixel_color, samples_per_pixel);
+    // Every pass takes the next pass_samples samples of each pixel. A pixel's
+    // sample count is also the index of its next sample, which keeps the random
+    // sequence the same however the render is split into passes and restarts.
+    while (sampler.update(samples) > 0) {
+        if (opts.engine == "wavefront") {
+            for_each_tile(image_width, image_height, opts.tile_size, opts.threads,
+                [&](const tile& tl) {
+                    uint64_t paths = 0;
+                    segment_count += wavefront.render_tile(tl, samples, [&](int i, int j) {
+                        auto n = sampler.samples_for_pass(samples, i, j, pass_samples);
+                        paths += std::max(n, 0);
+                        return n;
+                    });
+                    path_count += paths;
+                });
+        } else {
+            render_tiles(image_width, image_height, opts.tile_size, opts.threads,
+                [&](int i, int j) {
+                    auto pixel = size_t(j) * image_width + i;
+                    int first = samples.sample_count(i, j);
+                    int last = first + sampler.samples_for_pass(samples, i, j, pass_samples);
+                    if (first >= last)
+                        return;
+                    color pixel_color(0, 0, 0);
+                    real square_sum = 0;
+                    int segments = 0;
+#if RT_COUNTERS
+                    auto cost_before = thread_counters().cost();
+#endif
+
+                    if (opts.packet_size > 0) {
+                        // The camera samples of one pixel form a coherent packet. Each
+                        // lane keeps its own generator state, so the paths continue
+                        // exactly as they would have when traced one by one.
+                        ray rays[max_packet_size];
+                        pcg32 rng_states[max_packet_size];
+                        hit_record recs[max_packet_size];
+                        bool hits[max_packet_size];
+
+                        for (int s0 = first; s0 < last; s0 += opts.packet_size) {
+                            auto count = std::min(opts.packet_size, last - s0);
+                            for (int k = 0; k < count; ++k) {
+                                seed_sample(opts.seed, pixel, s0 + k, opts.frame);
+                                auto u = (i+random_double()) / (image_width-1);
+                                auto v = (j+random_double()) / (image_height-1);
+                                rays[k] = cam.get_ray(u, v);
+                                rng_states[k] = thread_rng();
+                            }
+
+                            packet_world->hit_packet(rays, count, 0, infinity, recs, hits);
+                            add_count(counter::camera_rays, count);
+
+                            for (int k = 0; k < count; ++k) {
+                                thread_rng() = rng_states[k];
+                                segments++;
+                                auto sample = hits[k] ? integrator.radiance(rays[k], recs[k], segments)
+                                                      : lights.sky_radiance(rays[k]);
+                                pixel_color += sample;
+                                square_sum += luminance(sample) * luminance(sample);
+                            }
+                        }
+                    } else {
+                        for (int s = first; s < last; ++s) {
+                            seed_sample(opts.seed, pixel, s, opts.frame);
+                            auto u = (i+random_double()) / (image_width-1);
+                            auto v = (j+random_double()) / (image_height-1);
+                            ray r = cam.get_ray(u, v);
+                            auto sample = integrator.radiance(r, segments);
+                            pixel_color += sample;
+                            square_sum += luminance(sample) * luminance(sample);
+                        }
+                    }
+
+#if RT_COUNTERS
+                    if (!pixel_cost.empty())
+                        pixel_cost[samples.index(i, j)] += thread_counters().cost() - cost_before;
+#endif
+
+                    samples.add(i, j, pixel_color, square_sum, last - first);
+                    path_count += last - first;
+                    segment_count += segments;
+                });
         }
+
+        std::cerr << "\rPass done, " << samples.min_sample_count() << " to "
+                  << *std::max_element(samples.counts.begin(), samples.counts.end())
+                  << " of " << samples_per_pixel << " samples per pixel.\n";
+
+        if (!opts.preview.empty()) {
+            samples.resolve(image);
+            write_image(image, image_format_from_path(opts.preview, image_format::ppm), opts.preview);
+        }
+        if (!opts.checkpoint.empty() && !state.save(opts.checkpoint))
+            return 1;
     }
 
     auto end = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
 
-    std::cerr << "\nDone. It takes " << duration << "ms.\n";
+    std::cerr << "\nDone. It takes " << duration << "ms with " << opts.threads << " threads.\n";
+    if (path_count > 0)
+        std::cerr << "Average path length: " << double(segment_count) / path_count << " rays, "
+                  << segment_count / (1000.0 * std::max<int64_t>(duration, 1)) << " Mrays/s.\n";
+    if (adaptive)
+        sampler.print_stats(samples, std::cerr);
+#if RT_COUNTERS
+    std::cerr << "Counters:\n";
+    total_counters().print(std::cerr);
+#endif
+
+    if (!opts.heatmap.empty()) {
+        cost_heatmap(pixel_cost, image_width, image_height, image);
+        write_image(image, image_format_from_path(opts.heatmap, image_format::ppm), opts.heatmap);
+    }
+
+    if (!opts.sample_map.empty()) {
+        sampler.sample_map(samples, image);
+        write_image(image, image_format_from_path(opts.sample_map, image_format::ppm), opts.sample_map);
+    }
+
+    begin = std::chrono::steady_clock::now();
+    samples.resolve(image);
+    if (!write_image(image, opts.format, opts.output))
+        return 1;
+    end = std::chrono::steady_clock::now();
+    std::cerr << "Writing the image takes "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "ms.\n";
 }
@@ -0,0 +1,94 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define RT_HAVE_MMAP 0
+#else
+#define RT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The contents of a file as one read-only block of memory. Where the platform
+// has mmap the file is mapped rather than read, so the pages come in on demand
+// as a parser walks through them and large files are never copied.
+class mapped_file {
+public:
+    mapped_file() {}
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<char> buffer; // without mmap, or for empty files
+};
+
+bool mapped_file::open(const std::string& path) {
+    close();
+
+#if RT_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    length = static_cast<size_t>(info.st_size);
+    if (length > 0) {
+        auto p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, length, MADV_SEQUENTIAL);
+            bytes = static_cast<const char*>(p);
+            mapped = true;
+        }
+    }
+    ::close(fd);
+    if (mapped || length == 0)
+        return true;
+#endif
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(buffer.data(), buffer.size()))
+        return false;
+    bytes = buffer.data();
+    length = buffer.size();
+    return true;
+}
+
+void mapped_file::close() {
+#if RT_HAVE_MMAP
+    if (mapped)
+        munmap(const_cast<char*>(bytes), length);
+#endif
+    bytes = nullptr;
+    length = 0;
+    mapped = false;
+    buffer.clear();
+}
+
+#endif
@@ -2,88 +2,152 @@
 #define MATERIAL_H
 
 #include "rtweekend.h"
+#include "hittable.h"
 
-struct hit_record;
+#include <cstdint>
+#include <vector>
 
-inline double schlick(double cosine, double ref_idx) {
+inline real schlick(real cosine, real ref_idx) {
     auto r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
     return r0 + (1-r0)*pow((1 - cosine), 5);
 }
 
-class material {
-public:
-    virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const = 0;
-};
+// The kind of bounce a material makes, so that paths can be given a separate
+// depth limit per kind.
+enum class bounce_type { diffuse, glossy, transmission };
 
-class lambertian : public material {
-public:
-    lambertian(const color& a) : albedo(a) {}
-
-    virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-    ) const override {
-        vec3 scatter_direction = rec.normal + random_unit_vector();
-        scattered = ray(rec.p, scatter_direction, r_in.time());
-        attenuation = albedo;
-        return true;
+const int bounce_type_count = 3;
+
+enum class material_type : uint32_t { lambertian, metal, dielectric, diffuse_light };
+
+// A material is plain data, tagged with its type. Objects refer to materials
+// by their index in a material_table, so a hit only copies a 32-bit id, and
+// scatter() picks the model with a switch instead of a virtual call.
+struct material {
+    material_type type;
+    color albedo;  // lambertian, metal; emitted radiance of diffuse_light
+    real fuzz;     // metal
+    real ref_idx;  // dielectric
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const;
+
+    // Radiance leaving the front face of a diffuse_light, black otherwise.
+    color emitted(const hit_record& rec) const {
+        return type == material_type::diffuse_light && rec.front_face ? albedo : color(0, 0, 0);
     }
 
-public:
-    color albedo;
+    // Light arriving from the unit direction is reflected toward the viewer
+    // in proportion to evaluate(), cosine included, and scatter() picks that
+    // direction with density pdf(). Only lambertian surfaces have either, so
+    // only they take light samples. Metal and dielectric scatter into a single
+    // direction or a lobe without a density here, and see lights by chance.
+    bool samples_lights() const { return type == material_type::lambertian; }
+    color evaluate(const hit_record& rec, const vec3& direction) const {
+        return albedo * (fmax(dot(rec.normal, direction), real(0)) / pi);
+    }
+    real pdf(const hit_record& rec, const vec3& direction) const {
+        return fmax(dot(rec.normal, direction), real(0)) / pi;
+    }
+
+    bounce_type bounce() const {
+        switch (type) {
+        case material_type::metal:      return bounce_type::glossy;
+        case material_type::dielectric: return bounce_type::transmission;
+        default:                        return bounce_type::diffuse;
+        }
+    }
 };
 
-class metal : public material {
-public:
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-
-    virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-    ) const override {
-        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
-        attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
+inline material lambertian(const color& a) {
+    return {material_type::lambertian, a, 0, 1};
+}
+
+inline material metal(const color& a, real f) {
+    return {material_type::metal, a, f < 1 ? f : 1, 1};
+}
+
+inline material dielectric(real ri) {
+    return {material_type::dielectric, color(1, 1, 1), 0, ri};
+}
+
+inline material diffuse_light(const color& radiance) {
+    return {material_type::diffuse_light, radiance, 0, 1};
+}
+
+inline bool scatter_lambertian(
+    const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+) {
+    vec3 scatter_direction = rec.normal + random_unit_vector();
+    scattered = rec.spawn_ray(scatter_direction, r_in.time());
+    attenuation = m.albedo;
+    return true;
+}
+
+inline bool scatter_metal(
+    const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+) {
+    vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+    scattered = rec.spawn_ray(reflected + m.fuzz*random_in_unit_sphere(), r_in.time());
+    attenuation = m.albedo;
+    return (dot(scattered.direction(), rec.normal) > 0);
+}
+
+inline bool scatter_dielectric(
+    const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+) {
+    attenuation = color(1.0, 1.0, 1.0);
+    real etai_over_etat = rec.front_face ? (1.0 / m.ref_idx) : m.ref_idx;
+
+    vec3 unit_direction = unit_vector(r_in.direction());
+
+    real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+    real sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+    if (etai_over_etat * sin_theta > 1.0) {
+        vec3 reflected = reflect(unit_direction, rec.normal);
+        scattered = rec.spawn_ray(reflected, r_in.time());
+        return true;
     }
+    real reflect_prob = schlick(cos_theta, etai_over_etat);
+    if (random_double() < reflect_prob) {
+        vec3 reflected = reflect(unit_direction, rec.normal);
+        scattered = rec.spawn_ray(reflected, r_in.time());
+        return true;
+    }
+    vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
+    scattered = rec.spawn_ray(refracted, r_in.time());
+    return true;
+}
 
-public:
-    color albedo;
-    double fuzz;
-};
+bool material::scatter(
+    const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+) const {
+    switch (type) {
+    case material_type::metal:
+        return scatter_metal(*this, r_in, rec, attenuation, scattered);
+    case material_type::dielectric:
+        return scatter_dielectric(*this, r_in, rec, attenuation, scattered);
+    case material_type::diffuse_light:
+        return false;
+    default:
+        return scatter_lambertian(*this, r_in, rec, attenuation, scattered);
+    }
+}
 
-class dielectric : public material {
+// The materials of a scene, indexed by the material ids in hit_record.
+class material_table {
 public:
-    dielectric(double ri) : ref_idx(ri) {}
-
-    virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-    ) const override {
-        attenuation = color(1.0, 1.0, 1.0);
-        double etai_over_etat = rec.front_face ? (1.0 / ref_idx) : ref_idx;
-
-        vec3 unit_direction = unit_vector(r_in.direction());
-
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
-        if (etai_over_etat * sin_theta > 1.0) {
-            vec3 reflected = reflect(unit_direction, rec.normal);
-            scattered = ray(rec.p, reflected, r_in.time());
-            return true;
-        }
-        double reflect_prob = schlick(cos_theta, etai_over_etat);
-        if (random_double() < reflect_prob) {
-            vec3 reflected = reflect(unit_direction, rec.normal);
-            scattered = ray(rec.p, reflected, r_in.time());
-            return true;
-        }
-        vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-        scattered = ray(rec.p, refracted, r_in.time());
-        return true;
+    uint32_t add(const material& m) {
+        materials.push_back(m);
+        return static_cast<uint32_t>(materials.size() - 1);
     }
 
-    double ref_idx;
+    const material& operator[](uint32_t id) const { return materials[id]; }
+
+    size_t size() const { return materials.size(); }
+
+public:
+    std::vector<material> materials;
 };
 
 #endif
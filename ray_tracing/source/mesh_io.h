@@ -0,0 +1,409 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include "rtweekend.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Readers for triangle meshes, which append the vertex positions and the
+// triangle indices of a file to positions and indices. Polygons are split into
+// fans of triangles. Both parse the memory mapped file in a single pass without
+// copying lines out of it. On failure they return false and set error.
+//
+// OBJ: "v" and "f" records, with negative (relative) indices and the v/vt/vn
+// forms; everything else is skipped.
+// PLY: binary, either endianness, with a vertex element holding x, y and z and
+// a face element holding a vertex_indices (or vertex_index) list.
+bool parse_obj(
+    const char* begin, const char* end,
+    std::vector<point3>& positions, std::vector<uint32_t>& indices, std::string& error);
+bool parse_ply(
+    const char* begin, const char* end,
+    std::vector<point3>& positions, std::vector<uint32_t>& indices, std::string& error);
+
+// Picks the reader by the extension of path, .obj or .ply.
+bool load_mesh(const std::string& path, std::vector<point3>& positions, std::vector<uint32_t>& indices);
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Appends the fan of triangles of a polygon.
+inline void add_polygon(const std::vector<uint32_t>& polygon, std::vector<uint32_t>& indices) {
+    for (size_t k = 1; k + 1 < polygon.size(); ++k) {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[k]);
+        indices.push_back(polygon[k + 1]);
+    }
+}
+
+inline bool check_indices(size_t first, const std::vector<point3>& positions,
+                          const std::vector<uint32_t>& indices, std::string& error) {
+    for (size_t k = first; k < indices.size(); ++k) {
+        if (indices[k] >= positions.size()) {
+            error = "vertex index " + std::to_string(indices[k]) + " out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_obj(
+    const char* p, const char* end,
+    std::vector<point3>& positions, std::vector<uint32_t>& indices, std::string& error
+) {
+    auto first_index = indices.size();
+    std::vector<uint32_t> polygon;
+    size_t line = 1;
+
+    auto fail = [&](const char* message) {
+        error = "line " + std::to_string(line) + ": " + message;
+        return false;
+    };
+
+    while (p < end) {
+        while (p < end && is_blank(*p))
+            ++p;
+
+        if (end - p > 1 && p[0] == 'v' && is_blank(p[1])) {
+            p += 2;
+            double v[3];
+            for (int a = 0; a < 3; a++) {
+                while (p < end && is_blank(*p))
+                    ++p;
+                if (p < end && *p == '+')
+                    ++p;
+                auto result = std::from_chars(p, end, v[a]);
+                if (result.ec != std::errc())
+                    return fail("bad vertex");
+                p = result.ptr;
+            }
+            positions.emplace_back(real(v[0]), real(v[1]), real(v[2]));
+        } else if (end - p > 1 && p[0] == 'f' && is_blank(p[1])) {
+            p += 2;
+            polygon.clear();
+            while (true) {
+                while (p < end && is_blank(*p))
+                    ++p;
+                if (p == end || *p == '\n' || *p == '#')
+                    break;
+
+                int64_t index;
+                auto result = std::from_chars(p, end, index);
+                if (result.ec != std::errc() || index == 0)
+                    return fail("bad face index");
+                p = result.ptr;
+                // Skip the texture coordinate and normal indices of v/vt/vn.
+                while (p < end && !is_blank(*p) && *p != '\n')
+                    ++p;
+
+                // Negative indices count back from the last vertex so far.
+                index = index > 0 ? index - 1 : int64_t(positions.size()) + index;
+                if (index < 0 || index > int64_t(UINT32_MAX))
+                    return fail("face index out of range");
+                polygon.push_back(static_cast<uint32_t>(index));
+            }
+            add_polygon(polygon, indices);
+        }
+
+        // Skip the rest of the line, which is all of it for other records.
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+        ++line;
+    }
+
+    return check_indices(first_index, positions, indices, error);
+}
+
+enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+
+struct ply_property {
+    std::string name;
+    ply_type type;       // of the items, for lists
+    bool is_list = false;
+    ply_type count_type; // lists only
+};
+
+struct ply_element {
+    std::string name;
+    size_t count;
+    std::vector<ply_property> properties;
+};
+
+inline bool parse_ply_type(const std::string& name, ply_type& type) {
+    static const std::pair<const char*, ply_type> names[] = {
+        {"char", ply_type::int8},     {"int8", ply_type::int8},
+        {"uchar", ply_type::uint8},   {"uint8", ply_type::uint8},
+        {"short", ply_type::int16},   {"int16", ply_type::int16},
+        {"ushort", ply_type::uint16}, {"uint16", ply_type::uint16},
+        {"int", ply_type::int32},     {"int32", ply_type::int32},
+        {"uint", ply_type::uint32},   {"uint32", ply_type::uint32},
+        {"float", ply_type::float32}, {"float32", ply_type::float32},
+        {"double", ply_type::float64}, {"float64", ply_type::float64},
+    };
+    for (const auto& n : names) {
+        if (name == n.first) {
+            type = n.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline size_t ply_type_size(ply_type type) {
+    switch (type) {
+    case ply_type::int8:  case ply_type::uint8:  return 1;
+    case ply_type::int16: case ply_type::uint16: return 2;
+    case ply_type::float64:                      return 8;
+    default:                                     return 4;
+    }
+}
+
+// Reads one value of type at p, swapping the bytes if the file's endianness
+// differs from the machine's. The caller has checked that it is in bounds.
+inline double read_ply_value(const char* p, ply_type type, bool swap) {
+    char b[8];
+    auto size = ply_type_size(type);
+    for (size_t i = 0; i < size; ++i)
+        b[i] = p[swap ? size - 1 - i : i];
+
+    switch (type) {
+    case ply_type::int8:    { int8_t v;   std::memcpy(&v, b, 1); return v; }
+    case ply_type::uint8:   { uint8_t v;  std::memcpy(&v, b, 1); return v; }
+    case ply_type::int16:   { int16_t v;  std::memcpy(&v, b, 2); return v; }
+    case ply_type::uint16:  { uint16_t v; std::memcpy(&v, b, 2); return v; }
+    case ply_type::int32:   { int32_t v;  std::memcpy(&v, b, 4); return v; }
+    case ply_type::uint32:  { uint32_t v; std::memcpy(&v, b, 4); return v; }
+    case ply_type::float32: { float v;    std::memcpy(&v, b, 4); return v; }
+    default:                { double v;   std::memcpy(&v, b, 8); return v; }
+    }
+}
+
+bool parse_ply(
+    const char* p, const char* end,
+    std::vector<point3>& positions, std::vector<uint32_t>& indices, std::string& error
+) {
+    if (p == end) {
+        error = "file is empty";
+        return false;
+    }
+
+    auto first_index = indices.size();
+    std::vector<ply_element> elements;
+    bool big_endian = false;
+    bool has_format = false;
+
+    // The header is a few lines of text, small enough to take apart as strings.
+    for (bool first_line = true; ; first_line = false) {
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!newline) {
+            error = "header has no end_header";
+            return false;
+        }
+        std::istringstream line(std::string(p, newline));
+        p = newline + 1;
+
+        std::string keyword;
+        line >> keyword;
+        if (first_line && keyword != "ply") {
+            error = "not a PLY file";
+            return false;
+        }
+
+        if (keyword == "format") {
+            std::string format;
+            line >> format;
+            if (format == "ascii") {
+                error = "ASCII PLY is not supported, only binary";
+                return false;
+            }
+            if (format != "binary_little_endian" && format != "binary_big_endian") {
+                error = "unknown format " + format;
+                return false;
+            }
+            big_endian = format == "binary_big_endian";
+            has_format = true;
+        } else if (keyword == "element") {
+            ply_element element;
+            line >> element.name >> element.count;
+            if (!line) {
+                error = "bad element line";
+                return false;
+            }
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            ply_property property;
+            std::string type;
+            line >> type;
+            if (type == "list") {
+                std::string count_type;
+                line >> count_type >> type;
+                property.is_list = true;
+                if (!parse_ply_type(count_type, property.count_type)) {
+                    error = "unknown property type " + count_type;
+                    return false;
+                }
+            }
+            line >> property.name;
+            if (!parse_ply_type(type, property.type) || elements.empty()) {
+                error = "bad property line";
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            break;
+        }
+    }
+
+    if (!has_format) {
+        error = "header has no format";
+        return false;
+    }
+
+    const uint16_t probe = 1;
+    bool machine_big_endian = *reinterpret_cast<const unsigned char*>(&probe) == 0;
+    bool swap = big_endian != machine_big_endian;
+
+    auto truncated = [&] {
+        error = "file is truncated";
+        return false;
+    };
+
+    std::vector<uint32_t> polygon;
+
+    for (const auto& element : elements) {
+        bool is_vertex = element.name == "vertex";
+        bool is_face = element.name == "face";
+
+        int xyz[3] = {-1, -1, -1};
+        size_t stride = 0;
+        size_t min_stride = 0; // with every list empty
+        bool fixed_size = true;
+        for (size_t k = 0; k < element.properties.size(); ++k) {
+            const auto& property = element.properties[k];
+            fixed_size = fixed_size && !property.is_list;
+            stride += ply_type_size(property.type);
+            min_stride += ply_type_size(property.is_list ? property.count_type : property.type);
+            for (int a = 0; a < 3; a++)
+                if (!property.is_list && property.name == std::string(1, char('x' + a)))
+                    xyz[a] = static_cast<int>(k);
+        }
+
+        if (is_vertex && (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0)) {
+            error = "vertex element without x, y and z";
+            return false;
+        }
+
+        // Elements other than vertex and face are skipped, in one step if
+        // they have no lists.
+        if (!is_vertex && !is_face && fixed_size) {
+            if (size_t(end - p) / std::max<size_t>(stride, 1) < element.count)
+                return truncated();
+            p += element.count * stride;
+            continue;
+        }
+
+        // The count comes from the header, so it is checked against what is
+        // left of the file before anything is reserved for it.
+        if (size_t(end - p) / std::max<size_t>(min_stride, 1) < element.count)
+            return truncated();
+        if (is_vertex)
+            positions.reserve(positions.size() + element.count);
+        if (is_face)
+            indices.reserve(indices.size() + 3 * element.count);
+
+        for (size_t n = 0; n < element.count; ++n) {
+            double v[3] = {0, 0, 0};
+            for (size_t k = 0; k < element.properties.size(); ++k) {
+                const auto& property = element.properties[k];
+                auto size = ply_type_size(property.type);
+
+                if (!property.is_list) {
+                    if (size_t(end - p) < size)
+                        return truncated();
+                    if (is_vertex)
+                        for (int a = 0; a < 3; a++)
+                            if (xyz[a] == int(k))
+                                v[a] = read_ply_value(p, property.type, swap);
+                    p += size;
+                    continue;
+                }
+
+                auto count_size = ply_type_size(property.count_type);
+                if (size_t(end - p) < count_size)
+                    return truncated();
+                auto list_count = read_ply_value(p, property.count_type, swap);
+                if (list_count < 0 || list_count != std::floor(list_count)) {
+                    error = "bad list count";
+                    return false;
+                }
+                if (list_count > double(end - p))
+                    return truncated();
+                auto count = static_cast<size_t>(list_count);
+                p += count_size;
+                if (size_t(end - p) / size < count)
+                    return truncated();
+
+                if (is_face && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+                    polygon.clear();
+                    for (size_t i = 0; i < count; ++i) {
+                        auto index = read_ply_value(p + i * size, property.type, swap);
+                        if (index < 0 || index > double(UINT32_MAX)) {
+                            error = "face index out of range";
+                            return false;
+                        }
+                        polygon.push_back(static_cast<uint32_t>(index));
+                    }
+                    add_polygon(polygon, indices);
+                }
+                p += count * size;
+            }
+            if (is_vertex)
+                positions.emplace_back(real(v[0]), real(v[1]), real(v[2]));
+        }
+    }
+
+    return check_indices(first_index, positions, indices, error);
+}
+
+bool load_mesh(const std::string& path, std::vector<point3>& positions, std::vector<uint32_t>& indices) {
+    auto dot = path.rfind('.');
+    auto extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    for (auto& c : extension)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+    if (extension != "obj" && extension != "ply") {
+        std::cerr << path << ": unknown mesh format, expected .obj or .ply\n";
+        return false;
+    }
+
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cerr << "Cannot read " << path << '\n';
+        return false;
+    }
+
+    std::string error;
+    auto begin = file.data(), end = file.data() + file.size();
+    auto first_index = indices.size();
+    bool ok = extension == "obj" ? parse_obj(begin, end, positions, indices, error)
+                                 : parse_ply(begin, end, positions, indices, error);
+    // A mesh without triangles would have no bounds to build a BVH over.
+    if (ok && indices.size() == first_index) {
+        error = "no faces";
+        ok = false;
+    }
+    if (!ok)
+        std::cerr << path << ": " << error << '\n';
+    return ok;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// A node of motion_bvh, with its bounds at the opening and at the closing of
+// the shutter. The first half has the layout of linear_bvh_node.
+struct motion_bvh_node {
+    float bounds0_min[3];
+    uint32_t offset;          // leaf: first primitive, interior: second child
+    float bounds0_max[3];
+    uint16_t primitive_count; // zero for interior nodes
+    uint8_t axis;             // split axis of interior nodes
+    uint8_t pad;
+    float bounds1_min[3];
+    float bounds1_max[3];
+};
+
+static_assert(sizeof(motion_bvh_node) == 56, "motion_bvh_node must stay 56 bytes");
+
+// time runs from 0 at the opening of the shutter to 1 at its closing.
+inline node_box bounds_at(const motion_bvh_node& node, float time) {
+    node_box box;
+    for (int a = 0; a < 3; a++) {
+        box.min[a] = node.bounds0_min[a] + time * (node.bounds1_min[a] - node.bounds0_min[a]);
+        box.max[a] = node.bounds0_max[a] + time * (node.bounds1_max[a] - node.bounds0_max[a]);
+    }
+    return box;
+}
+
+// A BVH for scenes with motion blur. A linear_bvh node bounds everything its
+// primitives sweep over the whole shutter, so a fast object is tested by every
+// ray that crosses its path at any time. Here every node keeps its bounds at
+// the opening and at the closing of the shutter, and a ray tests the box
+// interpolated to its own time. That is exact for primitives that move
+// linearly, like moving_sphere, and conservative for a node over several of
+// them. Rays must have times within [time0, time1].
+class motion_bvh : public hittable {
+public:
+    motion_bvh() {}
+    motion_bvh(
+        hittable_list& list, real time0, real time1,
+        const bvh_build_options& options = bvh_build_options());
+
+    virtual bool hit(
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    // Bytes held by the node and primitive arrays.
+    size_t memory_usage() const;
+
+    bool hit_counted(
+        const ray& r, real tmin, real tmax, hit_record& rec, traversal_stats& stats) const {
+        return traverse(r, tmin, tmax, rec, stats);
+    }
+
+private:
+    template <typename Stats>
+    bool traverse(const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats) const;
+
+public:
+    std::vector<motion_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    real time0 = 0, time1 = 1;
+    aabb box;
+};
+
+motion_bvh::motion_bvh(
+    hittable_list& list, real t0, real t1, const bvh_build_options& options
+) : time0(t0), time1(t1) {
+    auto n = list.objects.size();
+    std::vector<aabb> open(n), close(n), middle(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (!list.objects[i]->bounding_box(time0, time0, open[i])
+            || !list.objects[i]->bounding_box(time1, time1, close[i]))
+            std::cerr << "No bounding box in motion_bvh constructor.\n";
+        middle[i] = aabb(0.5 * (open[i].min() + close[i].min()), 0.5 * (open[i].max() + close[i].max()));
+    }
+    list.bounding_box(time0, time1, box);
+
+    // The split is chosen for the boxes halfway through the shutter, which
+    // stand in for the average box over it.
+    std::vector<linear_bvh_node> tree;
+    std::vector<uint32_t> order;
+    build_sah_bvh(middle, options, tree, order);
+
+    primitives.reserve(order.size());
+    for (auto index : order)
+        primitives.push_back(list.objects[index]);
+
+    // Both sets of bounds are fitted bottom-up over the tree. The float
+    // interpolation in bounds_at rounds by a few ulps, so leaf bounds are
+    // padded by more than that, which keeps every interpolated box
+    // conservative.
+    const float pad = 8 * std::numeric_limits<float>::epsilon();
+    nodes.resize(tree.size());
+    for (auto k = tree.size(); k-- > 0; ) {
+        const auto& in = tree[k];
+        auto& out = nodes[k];
+        out.offset = in.offset;
+        out.primitive_count = in.primitive_count;
+        out.axis = in.axis;
+        out.pad = 0;
+
+        if (in.primitive_count > 0) {
+            aabb leaf_open = open[order[in.offset]], leaf_close = close[order[in.offset]];
+            for (uint32_t i = in.offset + 1; i < in.offset + in.primitive_count; ++i) {
+                leaf_open = surrounding_box(leaf_open, open[order[i]]);
+                leaf_close = surrounding_box(leaf_close, close[order[i]]);
+            }
+            for (int a = 0; a < 3; a++) {
+                auto magnitude = static_cast<float>(fmax(
+                    fmax(fabs(leaf_open.min()[a]), fabs(leaf_open.max()[a])),
+                    fmax(fabs(leaf_close.min()[a]), fabs(leaf_close.max()[a]))));
+                out.bounds0_min[a] = round_down(leaf_open.min()[a]) - pad * magnitude;
+                out.bounds0_max[a] = round_up(leaf_open.max()[a]) + pad * magnitude;
+                out.bounds1_min[a] = round_down(leaf_close.min()[a]) - pad * magnitude;
+                out.bounds1_max[a] = round_up(leaf_close.max()[a]) + pad * magnitude;
+            }
+        } else {
+            const auto& first = nodes[k + 1];
+            const auto& second = nodes[in.offset];
+            for (int a = 0; a < 3; a++) {
+                out.bounds0_min[a] = std::min(first.bounds0_min[a], second.bounds0_min[a]);
+                out.bounds0_max[a] = std::max(first.bounds0_max[a], second.bounds0_max[a]);
+                out.bounds1_min[a] = std::min(first.bounds1_min[a], second.bounds1_min[a]);
+                out.bounds1_max[a] = std::max(first.bounds1_max[a], second.bounds1_max[a]);
+            }
+        }
+    }
+}
+
+size_t motion_bvh::memory_usage() const {
+    return nodes.capacity() * sizeof(motion_bvh_node)
+         + primitives.capacity() * sizeof(shared_ptr<hittable>);
+}
+
+bool motion_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    no_traversal_stats stats;
+    return traverse(r, t_min, t_max, rec, stats);
+}
+
+template <typename Stats>
+bool motion_bvh::traverse(
+    const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats
+) const {
+    // The nodes are walked with the time as a fraction of the shutter, and the
+    // primitives are tested with the ray as it was given.
+    auto shutter = time1 > time0 ? (r.time() - time0) / (time1 - time0) : real(0);
+    ray node_ray = r;
+    node_ray.tm = shutter;
+
+    return traverse_bvh(nodes.data(), nodes.size(), node_ray, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            bool hit_anything = false;
+            for (auto i = first; i < first + count; ++i) {
+                stats.test_primitive();
+                if (primitives[i]->hit(r, t_min, closest_so_far, rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+}
+
+bool motion_bvh::occluded(const ray& r, real t_min, real t_max) const {
+    auto shutter = time1 > time0 ? (r.time() - time0) / (time1 - time0) : real(0);
+    ray node_ray = r;
+    node_ray.tm = shutter;
+
+    no_traversal_stats stats;
+    return traverse_bvh<true>(nodes.data(), nodes.size(), node_ray, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            for (auto i = first; i < first + count; ++i) {
+                if (primitives[i]->occluded(r, t_min, closest_so_far))
+                    return true;
+            }
+            return false;
+        });
+}
+
+bool motion_bvh::bounding_box(real t0, real t1, aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+#endif
@@ -4,30 +4,33 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "aabb.h"
+#include "sphere.h"
 
 class moving_sphere : public hittable {
 public:
     moving_sphere() {}
     moving_sphere(
-        point3 cen0, point3 cen1, double t0, double t1, double r, shared_ptr<material> m)
-        : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m)
+        point3 cen0, point3 cen1, real t0, real t1, real r, uint32_t m)
+        : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), material_id(m)
     {};
 
     virtual bool hit(
-        const ray& r, double tmin, double tmax, hit_record& rec) const override;
-    virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
 
-    point3 center(double time) const;
+    point3 center(real time) const;
 
 public:
     point3 center0, center1;
-    double time0, time1;
-    double radius;
-    shared_ptr<material> mat_ptr;
+    real time0, time1;
+    real radius;
+    uint32_t material_id;
 };
 
 bool moving_sphere::hit(
-    const ray& r, double t_min, double t_max, hit_record& rec) const {
+    const ray& r, real t_min, real t_max, hit_record& rec) const {
+    add_count(counter::primitive_tests);
     vec3 oc = r.origin() - center(r.time());
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -40,32 +43,31 @@ bool moving_sphere::hit(
 
         auto temp = (-half_b - root) / a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            auto outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            set_sphere_hit(rec, r, temp, center(r.time()), radius);
+            rec.material_id = material_id;
             return true;
         }
 
         temp = (-half_b + root) / a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            auto outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            set_sphere_hit(rec, r, temp, center(r.time()), radius);
+            rec.material_id = material_id;
             return true;
         }
     }
     return false;
 }
 
-point3 moving_sphere::center(double time) const {
+bool moving_sphere::occluded(const ray& r, real t_min, real t_max) const {
+    add_count(counter::primitive_tests);
+    return sphere_occludes(r, t_min, t_max, center(r.time()), radius);
+}
+
+point3 moving_sphere::center(real time) const {
     return center0 + ((time - time0) / (time1 - time0))*(center1 - center0);
 }
 
-bool moving_sphere::bounding_box(double t0, double t1, aabb& output_box) const {
+bool moving_sphere::bounding_box(real t0, real t1, aabb& output_box) const {
     aabb box0(
         center(t0) - vec3(radius, radius, radius),
         center(t0) + vec3(radius, radius, radius));
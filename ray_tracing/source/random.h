@@ -0,0 +1,72 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+// PCG32 (XSH-RR variant) by Melissa O'Neill. Eight bytes of state plus a stream
+// selector, and about a dozen instructions per draw.
+class pcg32 {
+public:
+    pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    pcg32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+    void seed(uint64_t initstate, uint64_t initseq) {
+        state = 0;
+        inc = (initseq << 1) | 1;
+        next_uint();
+        state += initstate;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        auto rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // Returns a random real in [0, 1).
+    double next_double() {
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+    // Returns a random float in [0, 1). Only the top 24 bits are used, since
+    // rounding more of them could produce 1.
+    float next_float() {
+        return (next_uint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+public:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// SplitMix64 finalizer, used to turn structured seeds into well mixed states.
+inline uint64_t mix_bits(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// The generator used by random_double() and every sampling helper built on it.
+// It is owned by the calling thread, so workers never share random state.
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
+
+inline void seed_random(uint64_t seed, uint64_t stream = 0) {
+    thread_rng().seed(mix_bits(seed), stream);
+}
+
+// Seeds the thread's generator for one camera sample. The sequence depends only
+// on (seed, pixel, sample, frame), so any sample of any pixel can be reproduced
+// without rendering the rest of the image.
+inline void seed_sample(uint64_t seed, uint64_t pixel, uint32_t sample, uint32_t frame = 0) {
+    auto key = mix_bits(seed ^ mix_bits(pixel ^ (uint64_t(frame) << 40)));
+    thread_rng().seed(mix_bits(key ^ sample), key);
+}
+
+#endif
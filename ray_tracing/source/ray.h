@@ -3,25 +3,35 @@
 
 #include "vec3.h"
 
+// A ray also keeps the inverse of its direction and which components of it
+// are negative, which every box test along it needs. A zero component gives
+// an infinite inverse, which the slab tests are written to handle.
 class ray {
 public:
     ray() {}
-    ray(const point3& origin, const vec3& direction, double time = 0.0)
+    ray(const point3& origin, const vec3& direction, real time = 0.0)
         : orig(origin), dir(direction), tm(time)
-    {}
+    {
+        for (int a = 0; a < 3; a++) {
+            inv_dir[a] = 1 / dir[a];
+            dir_is_neg[a] = inv_dir[a] < 0;
+        }
+    }
 
     point3 origin() const  { return orig; }
     vec3 direction() const { return dir; }
-    double time() const    { return tm; }
+    real time() const    { return tm; }
 
-    point3 at(double t) const {
+    point3 at(real t) const {
         return orig + t*dir;
     }
 
 public:
     point3 orig;
     vec3 dir;
-    double tm;
+    real tm;
+    vec3 inv_dir;
+    int dir_is_neg[3];
 };
 
 #endif
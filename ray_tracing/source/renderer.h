@@ -0,0 +1,135 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct tile {
+    int x0, y0; // inclusive
+    int x1, y1; // exclusive
+};
+
+inline std::vector<tile> make_tiles(int image_width, int image_height, int tile_size) {
+    std::vector<tile> tiles;
+
+    for (int y = 0; y < image_height; y += tile_size) {
+        for (int x = 0; x < image_width; x += tile_size) {
+            tiles.push_back({
+                x, y,
+                std::min(x + tile_size, image_width),
+                std::min(y + tile_size, image_height)});
+        }
+    }
+
+    return tiles;
+}
+
+// Each worker owns a queue of tile indices. A worker pops work from the front
+// of its own queue and, once that runs dry, steals from the back of the others.
+class work_stealing_scheduler {
+public:
+    work_stealing_scheduler(size_t task_count, int worker_count)
+        : queues(worker_count)
+    {
+        // Hand out contiguous runs so neighbouring tiles stay on one worker.
+        for (size_t i = 0; i < task_count; ++i)
+            queues[i * worker_count / task_count].tasks.push_back(i);
+    }
+
+    bool next(int worker, size_t& task) {
+        if (queues[worker].pop_front(task))
+            return true;
+
+        for (size_t k = 1; k < queues.size(); ++k) {
+            auto victim = (worker + k) % queues.size();
+            if (queues[victim].pop_back(task))
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+
+        bool pop_front(size_t& task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) return false;
+            task = tasks.front();
+            tasks.pop_front();
+            return true;
+        }
+
+        bool pop_back(size_t& task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) return false;
+            task = tasks.back();
+            tasks.pop_back();
+            return true;
+        }
+    };
+
+    std::vector<task_queue> queues;
+};
+
+// Hands the tiles of the image to thread_count workers, calling
+// render_tile(const tile&) once for every tile. render_tile is expected to seed
+// the random generator per sample (see seed_sample), so the result does not
+// depend on which worker rendered which tile.
+template <typename RenderTile>
+void for_each_tile(
+    int image_width, int image_height, int tile_size, int thread_count,
+    RenderTile render_tile
+) {
+    auto tiles = make_tiles(image_width, image_height, tile_size);
+    thread_count = std::max(1, std::min<int>(thread_count, static_cast<int>(tiles.size())));
+
+    work_stealing_scheduler scheduler(tiles.size(), thread_count);
+    std::atomic<size_t> tiles_remaining(tiles.size());
+    std::mutex progress_mutex;
+
+    auto worker = [&](int index) {
+        size_t t;
+        while (scheduler.next(index, t)) {
+            render_tile(tiles[t]);
+
+            auto remaining = --tiles_remaining;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            std::cerr << "\rTiles remaining: " << remaining << ' ' << std::flush;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int k = 1; k < thread_count; ++k)
+        threads.emplace_back(worker, k);
+    worker(0);
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// Same, calling render_pixel(i, j) once for every pixel, with j = 0 at the
+// bottom row.
+template <typename RenderPixel>
+void render_tiles(
+    int image_width, int image_height, int tile_size, int thread_count,
+    RenderPixel render_pixel
+) {
+    for_each_tile(image_width, image_height, tile_size, thread_count,
+        [&](const tile& tl) {
+            for (int j = tl.y0; j < tl.y1; ++j)
+                for (int i = tl.x0; i < tl.x1; ++i)
+                    render_pixel(i, j);
+        });
+}
+
+#endif
@@ -5,9 +5,16 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
-#include <random>
 
-#define USE_CXX_RANDOM 1
+#include "random.h"
+
+// Scalar type of the whole math layer. Configure with RAY_TRACING_FLOAT=ON
+// to trace in single precision.
+#if RT_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
 
 // Usings
 
@@ -17,31 +24,29 @@ using std::sqrt;
 
 // Constants
 
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = static_cast<real>(3.1415926535897932385);
 
 // Utility Functions
 
-inline double degrees_to_radians(double degree) {
+inline real degrees_to_radians(real degree) {
     return degree * pi / 180.0;
 }
 
-inline double random_double() {
-#if USE_CXX_RANDOM
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+// Returns a random real in [0, 1).
+inline real random_double() {
+#if RT_USE_FLOAT
+    return thread_rng().next_float();
 #else
-    // Returns a randon real in [0, 1).
-    return rand() / (RAND_MAX + 1.0);
+    return thread_rng().next_double();
 #endif
 }
 
-inline double random_double(double min, double max) {
+inline real random_double(real min, real max) {
     return min + (max-min) * random_double();
 }
 
-inline double clamp(double x, double min, double max) {
+inline real clamp(real x, real min, real max) {
     if (x < min) return min;
     if (x > max) return max;
     return x;
@@ -0,0 +1,316 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "camera.h"
+#include "material.h"
+#include "sphere_soa.h"
+#include "arena.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+#include "light.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// random_scene() is written once against these adapters, so the same scene can
+// be built from separate sphere objects or into a sphere_soa.
+struct hittable_list_builder {
+    hittable_list& world;
+    material_table& materials;
+    arena* storage; // the heap if null
+
+    uint32_t add_material(const material& m) { return materials.add(m); }
+
+    void add_sphere(point3 center, real radius, uint32_t m) {
+        world.add(make_in<sphere>(storage, center, radius, m));
+    }
+
+    void add_moving_sphere(
+        point3 center0, point3 center1, real t0, real t1, real radius, uint32_t m) {
+        world.add(make_in<moving_sphere>(storage, center0, center1, t0, t1, radius, m));
+    }
+};
+
+struct sphere_soa_builder {
+    sphere_soa& world;
+    material_table& materials;
+
+    uint32_t add_material(const material& m) { return materials.add(m); }
+
+    void add_sphere(point3 center, real radius, uint32_t m) {
+        world.add(center, radius, m);
+    }
+
+    void add_moving_sphere(
+        point3 center0, point3 center1, real t0, real t1, real radius, uint32_t m) {
+        world.add(center0, center1, t0, t1, radius, m);
+    }
+};
+
+// Builds the cover scene of Ray Tracing in One Weekend. Small spheres are laid
+// out on a (2*half_extent)^2 grid, so raising half_extent scales the scene up.
+// Without center_sphere the glass sphere in the middle is left out, to make
+// room for something else.
+template <typename Builder>
+void build_random_scene(Builder& world, int half_extent, bool center_sphere = true) {
+    auto ground_material = world.add_material(lambertian(color(0.5, 0.5, 0.5)));
+    world.add_sphere(point3(0, -1000, 0), 1000, ground_material);
+
+    for (int a = -half_extent; a < half_extent; a++) {
+        for (int b = -half_extent; b < half_extent; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                uint32_t sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = world.add_material(lambertian(albedo));
+                    auto center2 = center + vec3(0, random_double(0,.5), 0);
+                    world.add_moving_sphere(
+                        center, center2, 0.0, 1.0, 0.2, sphere_material);
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = world.add_material(metal(albedo, fuzz));
+                    world.add_sphere(center, 0.2, sphere_material);
+                } else {
+                    // glass
+                    sphere_material = world.add_material(dielectric(1.5));
+                    world.add_sphere(center, 0.2, sphere_material);
+                }
+            }
+        }
+    }
+
+    if (center_sphere) {
+        auto material1 = world.add_material(dielectric(1.5));
+        world.add_sphere(point3(0, 1, 0), 1.0, material1);
+    }
+
+    auto material2 = world.add_material(lambertian(color(0.4, 0.2, 0.1)));
+    world.add_sphere(point3(-4, 1, 0), 1.0, material2);
+
+    auto material3 = world.add_material(metal(color(0.7, 0.6, 0.5), 0.0));
+    world.add_sphere(point3(4, 1, 0), 1.0, material3);
+}
+
+// Turns the sky of random_scene down to dusk and hangs small bright lights
+// over it: three glowing spheres and a point light. Most of the light then
+// comes from sources that scattered rays rarely find.
+template <typename Builder>
+void build_random_lights(Builder& world, light_list& lights) {
+    lights.sky = 0.05;
+
+    const std::pair<point3, color> spheres[] = {
+        {point3(-2, 2.5, 2), color(60, 40, 20)},
+        {point3(3, 2, -2), color(20, 40, 60)},
+        {point3(6, 3, 1.5), color(50, 50, 50)},
+    };
+    for (const auto& s : spheres) {
+        auto m = world.add_material(diffuse_light(s.second));
+        world.add_sphere(s.first, 0.2, m);
+        lights.add_sphere(s.first, 0.2, s.second, m);
+    }
+
+    lights.add_point(point3(0, 8, 0), color(20, 20, 20));
+}
+
+// The materials of the scene are added to materials. The spheres are allocated
+// in storage when it is given, which must then outlive the list. With lights,
+// the scene is lit by build_random_lights().
+hittable_list random_scene(
+    material_table& materials, int half_extent = 11, arena* storage = nullptr,
+    bool center_sphere = true, light_list* lights = nullptr) {
+    hittable_list world;
+    hittable_list_builder builder{world, materials, storage};
+    build_random_scene(builder, half_extent, center_sphere);
+    if (lights)
+        build_random_lights(builder, *lights);
+    return world;
+}
+
+shared_ptr<sphere_soa> random_scene_soa(
+    material_table& materials, int half_extent, real time0, real time1,
+    light_list* lights = nullptr) {
+    auto world = make_shared<sphere_soa>();
+    sphere_soa_builder builder{*world, materials};
+    build_random_scene(builder, half_extent);
+    if (lights)
+        build_random_lights(builder, *lights);
+    world->build(time0, time1);
+    return world;
+}
+
+// Scales and moves the vertices of a mesh so that it is height tall and the
+// middle of the bottom of its bounds rests on base. Call before building it.
+void place_mesh(std::vector<point3>& positions, const point3& base, real height) {
+    if (positions.empty())
+        return;
+
+    point3 lo = positions[0], hi = positions[0];
+    for (const auto& p : positions) {
+        lo = point3(fmin(lo.x(), p.x()), fmin(lo.y(), p.y()), fmin(lo.z(), p.z()));
+        hi = point3(fmax(hi.x(), p.x()), fmax(hi.y(), p.y()), fmax(hi.z(), p.z()));
+    }
+
+    auto extent = hi - lo;
+    auto scale = height / fmax(extent.y(), real(1e-12));
+    point3 bottom(0.5 * (lo.x() + hi.x()), lo.y(), 0.5 * (lo.z() + hi.z()));
+    for (auto& p : positions)
+        p = base + scale * (p - bottom);
+}
+
+// Adds count copies of object, which must stand on the ground at the origin,
+// at random places, headings and sizes across the ground of random_scene.
+void scatter_instances(
+    instance_bvh& instances, const shared_ptr<const hittable>& object, int count,
+    int half_extent = 11, real time0 = 0, real time1 = 1
+) {
+    for (int k = 0; k < count; ++k) {
+        vec3 offset(random_double(-half_extent, half_extent), 0, random_double(-half_extent, half_extent));
+        auto to_world = transform::translate(offset)
+                      * transform::rotate(vec3(0, 1, 0), random_double(0, 360))
+                      * transform::scale(random_double(0.1, 0.3));
+        instances.add(object, to_world, time0, time1);
+    }
+}
+
+// A scene as plain data, as a scene file holds it (see scene_io.h). Objects
+// refer to materials by their index in materials, and are built in order.
+struct scene_sphere {
+    point3 center0, center1; // the same for a sphere that does not move
+    real time0, time1;
+    real radius;
+    uint32_t material;
+    bool moving;
+};
+
+struct scene_point_light {
+    point3 position;
+    color intensity;
+};
+
+struct scene_mesh {
+    uint32_t material;
+    std::string path; // the OBJ or PLY file the vertices came from, if any
+    point3 base;      // where place_mesh() stood them, height tall; a height of
+    real height;      // zero keeps the coordinates of the file
+    std::vector<point3> positions;
+    std::vector<uint32_t> indices;
+};
+
+struct scene_view {
+    point3 lookfrom, lookat;
+    vec3 vup;
+    real vfov; // vertical, in degrees
+    real aperture;
+    real focus_dist;
+};
+
+struct scene_description {
+    int image_width = 400;
+    double aspect_ratio = 16.0 / 9.0;
+    int samples_per_pixel = 100;
+    real time0 = 0, time1 = 1; // shutter
+    scene_view view = {point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 0.1, 10}; // random_scene_camera()
+    real sky = 1; // scale of the background
+    std::vector<material> materials;
+    std::vector<scene_sphere> spheres;
+    std::vector<scene_point_light> point_lights;
+    std::vector<scene_mesh> meshes;
+
+    int image_height() const { return static_cast<int>(image_width / aspect_ratio); }
+
+    camera make_camera() const {
+        return camera(view.lookfrom, view.lookat, view.vup, view.vfov, aspect_ratio,
+                      view.aperture, view.focus_dist, time0, time1);
+    }
+};
+
+// Records what build_random_scene() makes into a scene_description.
+struct scene_description_builder {
+    scene_description& scene;
+
+    uint32_t add_material(const material& m) {
+        scene.materials.push_back(m);
+        return static_cast<uint32_t>(scene.materials.size() - 1);
+    }
+
+    void add_sphere(point3 center, real radius, uint32_t m) {
+        scene.spheres.push_back({center, center, 0, 0, radius, m, false});
+    }
+
+    void add_moving_sphere(
+        point3 center0, point3 center1, real t0, real t1, real radius, uint32_t m) {
+        scene.spheres.push_back({center0, center1, t0, t1, radius, m, true});
+    }
+};
+
+scene_description random_scene_description(int half_extent = 11, bool center_sphere = true, bool lights = false) {
+    scene_description scene;
+    scene_description_builder builder{scene};
+    build_random_scene(builder, half_extent, center_sphere);
+    if (lights) {
+        light_list list;
+        build_random_lights(builder, list);
+        scene.sky = list.sky;
+        for (const auto& l : list.lights)
+            if (l.type == light_type::point)
+                scene.point_lights.push_back({l.position, l.intensity});
+    }
+    return scene;
+}
+
+// Adds the materials, spheres and lights of scene to world, and leaves the
+// meshes to the caller. Every sphere that does not move and has a
+// diffuse_light material is also a sphere light. Lights are found by material,
+// so each such sphere gets a copy of its material of its own, and the scene's
+// material stays no light for the meshes and moving spheres that use it.
+template <typename Builder>
+void build_scene(const scene_description& scene, Builder& world, light_list& lights) {
+    uint32_t first_material = 0;
+    for (size_t k = 0; k < scene.materials.size(); ++k) {
+        auto id = world.add_material(scene.materials[k]);
+        if (k == 0)
+            first_material = id;
+    }
+
+    lights.sky = scene.sky;
+    for (const auto& s : scene.spheres) {
+        auto m = first_material + s.material;
+        if (s.moving) {
+            world.add_moving_sphere(s.center0, s.center1, s.time0, s.time1, s.radius, m);
+            continue;
+        }
+        const auto& mat = scene.materials[s.material];
+        if (mat.type == material_type::diffuse_light) {
+            m = world.add_material(mat);
+            lights.add_sphere(s.center0, s.radius, mat.albedo, m);
+        }
+        world.add_sphere(s.center0, s.radius, m);
+    }
+    for (const auto& l : scene.point_lights)
+        lights.add_point(l.position, l.intensity);
+}
+
+camera random_scene_camera(real aspect_ratio, real t0, real t1) {
+    point3 lookfrom(13,2,3);
+    point3 lookat(0,0,0);
+    vec3 vup(0,1,0);
+    auto dist_to_focus = 10.0;
+    auto aperture = 0.1;
+
+    return camera(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus, t0, t1);
+}
+
+#endif
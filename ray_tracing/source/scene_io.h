@@ -0,0 +1,722 @@
+#ifndef SCENE_IO_H
+#define SCENE_IO_H
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "mapped_file.h"
+#include "mesh_io.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Scene files, which hold a scene_description in one of two forms.
+//
+// The text form has one record per line, and # starts a comment:
+//
+//   rtscene 1                        the first record, with the version
+//   image WIDTH ASPECT_RATIO SAMPLES
+//   shutter TIME0 TIME1
+//   camera FROM_XYZ AT_XYZ UP_XYZ VFOV APERTURE FOCUS_DIST
+//   sky SCALE
+//   lambertian R G B
+//   metal R G B FUZZ
+//   dielectric REF_IDX
+//   diffuse_light R G B
+//   sphere X Y Z RADIUS MATERIAL
+//   moving_sphere X0 Y0 Z0 X1 Y1 Z1 TIME0 TIME1 RADIUS MATERIAL
+//   point_light X Y Z R G B
+//   mesh MATERIAL X Y Z HEIGHT PATH
+//
+// Materials are numbered from zero in the order they come, and must come
+// before the objects that use them. A mesh is an OBJ or PLY file, relative to
+// the scene file, stood at X Y Z with place_mesh() unless HEIGHT is zero. Its
+// PATH runs to the end of the line or a #, so it cannot hold one. Like
+// the mesh readers, the parser walks the mapped file once without copying
+// lines out of it.
+//
+// Both forms fail to load a scene with no objects, or with numbers the
+// renderer cannot take: an image less than two pixels either way, a camera
+// that looks nowhere, a negative albedo and so on, or anything not finite.
+//
+// The binary form needs no parsing: a scene_file_header, then arrays of the
+// fixed-size records below, with the vertices and indices of the meshes
+// inline. Loading it only checks the mapped records and copies them out.
+bool parse_scene_text(
+    const char* begin, const char* end, const std::string& directory,
+    scene_description& scene, std::string& error);
+bool parse_scene_binary(const char* begin, const char* end, scene_description& scene, std::string& error);
+
+// Tells the forms apart by the magic of the binary one.
+bool load_scene(const std::string& path, scene_description& scene);
+
+// The binary form if path ends in .rtb, text otherwise. Meshes are written to
+// text as the absolute path of their file, so they need one.
+bool save_scene(const std::string& path, const scene_description& scene);
+
+const uint32_t scene_text_version = 1;
+
+// Binary layout, little endian. The material, sphere, point light and mesh
+// records follow the header in that order, and each mesh record gives the
+// offset from the start of the file of its vertices (three doubles each) and
+// of its indices (three uint32_t per triangle), which start 8-byte aligned.
+struct scene_file_header {
+    char magic[8];
+    uint32_t version;
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    uint32_t material_count;
+    uint64_t sphere_count;
+    uint32_t point_light_count;
+    uint32_t mesh_count;
+    double aspect_ratio;
+    double time0, time1;
+    double lookfrom[3], lookat[3], vup[3];
+    double vfov, aperture, focus_dist;
+    double sky;
+};
+
+struct scene_file_material {
+    uint32_t type;
+    uint32_t pad;
+    double albedo[3];
+    double fuzz, ref_idx;
+};
+
+struct scene_file_sphere {
+    double center0[3], center1[3];
+    double time0, time1;
+    double radius;
+    uint32_t material;
+    uint32_t moving;
+};
+
+struct scene_file_point_light {
+    double position[3];
+    double intensity[3];
+};
+
+struct scene_file_mesh {
+    uint32_t material;
+    uint32_t pad;
+    uint64_t vertex_count, triangle_count;
+    uint64_t vertex_offset, index_offset;
+};
+
+const char scene_file_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+const uint32_t scene_file_version = 1;
+
+inline point3 to_point3(const double v[3]) { return point3(real(v[0]), real(v[1]), real(v[2])); }
+
+inline void from_point3(const point3& p, double v[3]) {
+    for (int a = 0; a < 3; a++)
+        v[a] = p[a];
+}
+
+inline bool is_finite(const vec3& v) {
+    return std::isfinite(v[0]) && std::isfinite(v[1]) && std::isfinite(v[2]);
+}
+
+inline bool is_nonnegative(const vec3& v) {
+    return is_finite(v) && v[0] >= 0 && v[1] >= 0 && v[2] >= 0;
+}
+
+// The checks below hold the numbers of a scene file to what the renderer can
+// take, so a bad file fails to load instead of rendering NaN.
+
+// At least two columns and rows, since pixel coordinates divide by the width
+// and height less one.
+inline bool check_image(const scene_description& scene) {
+    return scene.image_width >= 2 && std::isfinite(scene.aspect_ratio) && scene.aspect_ratio > 0
+        && scene.image_height() >= 2 && scene.samples_per_pixel > 0;
+}
+
+inline bool check_shutter(real time0, real time1) {
+    return std::isfinite(time0) && std::isfinite(time1) && time0 <= time1;
+}
+
+// The camera needs a direction to look in and an up vector off its axis.
+inline bool check_view(const scene_view& view) {
+    if (!is_finite(view.lookfrom) || !is_finite(view.lookat) || !is_finite(view.vup))
+        return false;
+    if (cross(view.vup, view.lookfrom - view.lookat).length_squared() <= 0)
+        return false;
+    return view.vfov > 0 && view.vfov < 180 && std::isfinite(view.aperture) && view.aperture >= 0
+        && std::isfinite(view.focus_dist) && view.focus_dist > 0;
+}
+
+inline bool check_sky(real sky) { return std::isfinite(sky) && sky >= 0; }
+
+inline bool check_material(const material& m) {
+    return is_nonnegative(m.albedo) && std::isfinite(m.fuzz) && m.fuzz >= 0
+        && std::isfinite(m.ref_idx) && m.ref_idx > 0;
+}
+
+// All finite, and time0 < time1 for a sphere that moves. Anything else gives
+// the sphere NaN bounds.
+inline bool check_sphere(const scene_sphere& s) {
+    if (!is_finite(s.center0) || !is_finite(s.center1))
+        return false;
+    if (!std::isfinite(s.radius) || !std::isfinite(s.time0) || !std::isfinite(s.time1))
+        return false;
+    return !s.moving || s.time0 < s.time1;
+}
+
+inline bool check_point_light(const scene_point_light& l) {
+    return is_finite(l.position) && is_nonnegative(l.intensity);
+}
+
+// Where a mesh is stood; a height of zero keeps the coordinates of its file.
+inline bool check_mesh_placement(const point3& base, real height) {
+    return is_finite(base) && std::isfinite(height) && height >= 0;
+}
+
+// Loads the file of mesh, relative to directory, and stands it in place.
+inline bool load_scene_mesh(scene_mesh& mesh, const std::string& directory) {
+    auto path = std::filesystem::path(directory) / mesh.path;
+    if (!load_mesh(path.string(), mesh.positions, mesh.indices))
+        return false;
+    mesh.path = path.string();
+    if (mesh.height > 0)
+        place_mesh(mesh.positions, mesh.base, mesh.height);
+    return true;
+}
+
+bool parse_scene_text(
+    const char* p, const char* end, const std::string& directory,
+    scene_description& scene, std::string& error
+) {
+    size_t line = 1;
+    bool has_version = false;
+
+    auto fail = [&](const std::string& message) {
+        error = "line " + std::to_string(line) + ": " + message;
+        return false;
+    };
+
+    // Reads count numbers of the current line into v.
+    auto read = [&](auto* v, int count) {
+        for (int k = 0; k < count; ++k) {
+            while (p < end && is_blank(*p))
+                ++p;
+            if (p < end && *p == '+')
+                ++p;
+            auto result = std::from_chars(p, end, v[k]);
+            if (result.ec != std::errc())
+                return false;
+            p = result.ptr;
+        }
+        return true;
+    };
+
+    auto material_exists = [&](uint32_t m) { return m < scene.materials.size(); };
+
+    while (p < end) {
+        while (p < end && is_blank(*p))
+            ++p;
+        auto start = p;
+        while (p < end && (std::isalnum(static_cast<unsigned char>(*p)) || *p == '_'))
+            ++p;
+        std::string_view keyword(start, p - start);
+
+        real v[10] = {};
+        uint32_t m = 0;
+        bool ok = true;
+
+        if (keyword.empty()) {
+            // A blank line or a comment.
+        } else if (!has_version) {
+            uint32_t version;
+            if (keyword != "rtscene")
+                return fail("not a scene file");
+            if (!read(&version, 1) || version != scene_text_version)
+                return fail("unsupported version");
+            has_version = true;
+        } else if (keyword == "image") {
+            ok = read(&scene.image_width, 1) && read(&scene.aspect_ratio, 1) && read(&scene.samples_per_pixel, 1)
+              && check_image(scene);
+        } else if (keyword == "shutter") {
+            ok = read(v, 2) && check_shutter(v[0], v[1]);
+            scene.time0 = v[0];
+            scene.time1 = v[1];
+        } else if (keyword == "camera") {
+            ok = read(v, 9) && read(&scene.view.vfov, 1) && read(&scene.view.aperture, 1)
+              && read(&scene.view.focus_dist, 1);
+            scene.view.lookfrom = point3(v[0], v[1], v[2]);
+            scene.view.lookat = point3(v[3], v[4], v[5]);
+            scene.view.vup = vec3(v[6], v[7], v[8]);
+            ok = ok && check_view(scene.view);
+        } else if (keyword == "sky") {
+            ok = read(&scene.sky, 1) && check_sky(scene.sky);
+        } else if (keyword == "lambertian") {
+            ok = read(v, 3);
+            scene.materials.push_back(lambertian(color(v[0], v[1], v[2])));
+            ok = ok && check_material(scene.materials.back());
+        } else if (keyword == "metal") {
+            ok = read(v, 4);
+            scene.materials.push_back(metal(color(v[0], v[1], v[2]), v[3]));
+            ok = ok && std::isfinite(v[3]) && check_material(scene.materials.back()); // metal() clamps a NaN fuzz
+        } else if (keyword == "dielectric") {
+            ok = read(v, 1);
+            scene.materials.push_back(dielectric(v[0]));
+            ok = ok && check_material(scene.materials.back());
+        } else if (keyword == "diffuse_light") {
+            ok = read(v, 3);
+            scene.materials.push_back(diffuse_light(color(v[0], v[1], v[2])));
+            ok = ok && check_material(scene.materials.back());
+        } else if (keyword == "sphere") {
+            ok = read(v, 4) && read(&m, 1) && material_exists(m);
+            point3 center(v[0], v[1], v[2]);
+            scene.spheres.push_back({center, center, 0, 0, v[3], m, false});
+            ok = ok && check_sphere(scene.spheres.back());
+        } else if (keyword == "moving_sphere") {
+            ok = read(v, 9) && read(&m, 1) && material_exists(m);
+            scene.spheres.push_back(
+                {point3(v[0], v[1], v[2]), point3(v[3], v[4], v[5]), v[6], v[7], v[8], m, true});
+            ok = ok && check_sphere(scene.spheres.back());
+        } else if (keyword == "point_light") {
+            ok = read(v, 6);
+            scene.point_lights.push_back({point3(v[0], v[1], v[2]), color(v[3], v[4], v[5])});
+            ok = ok && check_point_light(scene.point_lights.back());
+        } else if (keyword == "mesh") {
+            if (!read(&m, 1) || !material_exists(m) || !read(v, 4)
+                || !check_mesh_placement(point3(v[0], v[1], v[2]), v[3]))
+                return fail("bad mesh record");
+
+            // The path is the rest of the line, up to a comment.
+            while (p < end && is_blank(*p))
+                ++p;
+            auto path_begin = p;
+            auto path_end = std::find_if(p, end, [](char c) { return c == '\n' || c == '#'; });
+            while (path_end > path_begin && is_blank(path_end[-1]))
+                --path_end;
+            p = path_end;
+            if (path_begin == path_end)
+                return fail("mesh without a path");
+
+            scene_mesh mesh = {m, std::string(path_begin, path_end), point3(v[0], v[1], v[2]), v[3], {}, {}};
+            if (!load_scene_mesh(mesh, directory))
+                return fail("cannot load mesh " + mesh.path);
+            scene.meshes.push_back(std::move(mesh));
+        } else {
+            return fail("unknown record " + std::string(keyword));
+        }
+
+        if (!ok)
+            return fail("bad " + std::string(keyword) + " record");
+
+        while (p < end && is_blank(*p))
+            ++p;
+        if (p < end && *p != '\n' && *p != '#')
+            return fail(keyword.empty() ? "unexpected text" : "unexpected text after " + std::string(keyword));
+
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+        ++line;
+    }
+
+    if (!has_version) {
+        error = "not a scene file";
+        return false;
+    }
+    if (scene.spheres.empty() && scene.meshes.empty()) {
+        error = "scene has no objects";
+        return false;
+    }
+    return true;
+}
+
+bool parse_scene_binary(const char* begin, const char* end, scene_description& scene, std::string& error) {
+    auto size = static_cast<size_t>(end - begin);
+    auto truncated = [&] {
+        error = "file is truncated";
+        return false;
+    };
+
+    scene_file_header header;
+    if (size < sizeof(header))
+        return truncated();
+    std::memcpy(&header, begin, sizeof(header));
+    if (std::memcmp(header.magic, scene_file_magic, sizeof(header.magic)) != 0) {
+        error = "not a binary scene file";
+        return false;
+    }
+    if (header.version != scene_file_version) {
+        error = "unsupported version " + std::to_string(header.version);
+        return false;
+    }
+    scene.image_width = header.image_width;
+    scene.samples_per_pixel = header.samples_per_pixel;
+    scene.aspect_ratio = header.aspect_ratio;
+    scene.time0 = real(header.time0);
+    scene.time1 = real(header.time1);
+    scene.view = {to_point3(header.lookfrom), to_point3(header.lookat), to_point3(header.vup),
+                  real(header.vfov), real(header.aperture), real(header.focus_dist)};
+    scene.sky = real(header.sky);
+    if (!check_image(scene)) {
+        error = "bad image settings";
+        return false;
+    }
+    if (!check_shutter(scene.time0, scene.time1)) {
+        error = "bad shutter";
+        return false;
+    }
+    if (!check_view(scene.view)) {
+        error = "bad camera";
+        return false;
+    }
+    if (!check_sky(scene.sky)) {
+        error = "bad sky";
+        return false;
+    }
+
+    // Points first at the next count records the size of record, or fails if
+    // the file ends before them.
+    size_t offset = sizeof(header);
+    auto records = [&](auto& record, uint64_t count, const char*& first) {
+        if ((size - offset) / sizeof(record) < count)
+            return false;
+        first = begin + offset;
+        offset += count * sizeof(record);
+        return true;
+    };
+
+    const char* first;
+    scene_file_material material_record;
+    if (!records(material_record, header.material_count, first))
+        return truncated();
+    scene.materials.resize(header.material_count);
+    for (size_t k = 0; k < header.material_count; ++k) {
+        std::memcpy(&material_record, first + k * sizeof(material_record), sizeof(material_record));
+        if (material_record.type > static_cast<uint32_t>(material_type::diffuse_light)) {
+            error = "material " + std::to_string(k) + " has an unknown type";
+            return false;
+        }
+        scene.materials[k] = {static_cast<material_type>(material_record.type), to_point3(material_record.albedo),
+                              real(material_record.fuzz), real(material_record.ref_idx)};
+        if (!check_material(scene.materials[k])) {
+            error = "material " + std::to_string(k) + " is out of range";
+            return false;
+        }
+    }
+
+    scene_file_sphere sphere_record;
+    if (!records(sphere_record, header.sphere_count, first))
+        return truncated();
+    scene.spheres.resize(header.sphere_count);
+    for (size_t k = 0; k < header.sphere_count; ++k) {
+        const auto& r = sphere_record;
+        std::memcpy(&sphere_record, first + k * sizeof(r), sizeof(r));
+        if (r.material >= header.material_count) {
+            error = "sphere " + std::to_string(k) + " has no material";
+            return false;
+        }
+        scene.spheres[k] = {to_point3(r.center0), to_point3(r.center1), real(r.time0), real(r.time1),
+                            real(r.radius), r.material, r.moving != 0};
+        if (!check_sphere(scene.spheres[k])) {
+            error = "sphere " + std::to_string(k) + " is not finite or does not move forward in time";
+            return false;
+        }
+    }
+
+    scene_file_point_light light_record;
+    if (!records(light_record, header.point_light_count, first))
+        return truncated();
+    scene.point_lights.resize(header.point_light_count);
+    for (size_t k = 0; k < header.point_light_count; ++k) {
+        std::memcpy(&light_record, first + k * sizeof(light_record), sizeof(light_record));
+        scene.point_lights[k] = {to_point3(light_record.position), to_point3(light_record.intensity)};
+        if (!check_point_light(scene.point_lights[k])) {
+            error = "point light " + std::to_string(k) + " is out of range";
+            return false;
+        }
+    }
+
+    scene_file_mesh mesh_record;
+    const char* first_mesh;
+    if (!records(mesh_record, header.mesh_count, first_mesh))
+        return truncated();
+    scene.meshes.resize(header.mesh_count);
+    for (size_t k = 0; k < header.mesh_count; ++k) {
+        const auto& r = mesh_record;
+        std::memcpy(&mesh_record, first_mesh + k * sizeof(r), sizeof(r));
+        if (r.material >= header.material_count) {
+            error = "mesh " + std::to_string(k) + " has no material";
+            return false;
+        }
+        if (r.vertex_offset > size || (size - r.vertex_offset) / (3 * sizeof(double)) < r.vertex_count
+            || r.index_offset > size || (size - r.index_offset) / (3 * sizeof(uint32_t)) < r.triangle_count)
+            return truncated();
+
+        auto& mesh = scene.meshes[k];
+        mesh = {r.material, std::string(), point3(0, 0, 0), 0, {}, {}};
+        mesh.positions.resize(r.vertex_count);
+        for (size_t n = 0; n < r.vertex_count; ++n) {
+            double v[3];
+            std::memcpy(v, begin + r.vertex_offset + n * sizeof(v), sizeof(v));
+            mesh.positions[n] = to_point3(v);
+        }
+        mesh.indices.resize(3 * r.triangle_count);
+        std::memcpy(mesh.indices.data(), begin + r.index_offset, mesh.indices.size() * sizeof(uint32_t));
+        if (!check_indices(0, mesh.positions, mesh.indices, error)) {
+            error = "mesh " + std::to_string(k) + ": " + error;
+            return false;
+        }
+    }
+
+    if (scene.spheres.empty() && scene.meshes.empty()) {
+        error = "scene has no objects";
+        return false;
+    }
+    return true;
+}
+
+bool load_scene(const std::string& path, scene_description& scene) {
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cerr << "Cannot read " << path << '\n';
+        return false;
+    }
+
+    std::string error;
+    auto begin = file.data(), end = file.data() + file.size();
+    bool binary = file.size() >= sizeof(scene_file_magic)
+               && std::memcmp(begin, scene_file_magic, sizeof(scene_file_magic)) == 0;
+    bool ok = binary ? parse_scene_binary(begin, end, scene, error)
+                     : parse_scene_text(begin, end, std::filesystem::path(path).parent_path().string(), scene, error);
+    if (!ok)
+        std::cerr << path << ": " << error << '\n';
+    return ok;
+}
+
+inline bool write_scene_text(std::ostream& out, const scene_description& scene, std::string& error) {
+    std::string line;
+
+    auto flush = [&] {
+        out.write(line.data(), line.size());
+        line.clear();
+    };
+    // Starts a line, and writes out the ones before it now and then.
+    auto record = [&](const char* keyword) {
+        if (line.size() > (1 << 16))
+            flush();
+        line += keyword;
+    };
+    auto number = [&](auto value) {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        line += ' ';
+        line.append(buffer, result.ptr);
+    };
+    auto triple = [&](const vec3& v) {
+        for (int a = 0; a < 3; a++)
+            number(v[a]);
+    };
+
+    record("rtscene");
+    number(scene_text_version);
+    line += '\n';
+    record("image");
+    number(scene.image_width);
+    number(scene.aspect_ratio);
+    number(scene.samples_per_pixel);
+    line += '\n';
+    record("shutter");
+    number(scene.time0);
+    number(scene.time1);
+    line += '\n';
+    record("camera");
+    triple(scene.view.lookfrom);
+    triple(scene.view.lookat);
+    triple(scene.view.vup);
+    number(scene.view.vfov);
+    number(scene.view.aperture);
+    number(scene.view.focus_dist);
+    line += '\n';
+    record("sky");
+    number(scene.sky);
+    line += '\n';
+
+    for (const auto& m : scene.materials) {
+        switch (m.type) {
+        case material_type::metal:
+            record("metal");
+            triple(m.albedo);
+            number(m.fuzz);
+            break;
+        case material_type::dielectric:
+            record("dielectric");
+            number(m.ref_idx);
+            break;
+        case material_type::diffuse_light:
+            record("diffuse_light");
+            triple(m.albedo);
+            break;
+        default:
+            record("lambertian");
+            triple(m.albedo);
+            break;
+        }
+        line += '\n';
+    }
+
+    for (const auto& s : scene.spheres) {
+        if (s.moving) {
+            record("moving_sphere");
+            triple(s.center0);
+            triple(s.center1);
+            number(s.time0);
+            number(s.time1);
+        } else {
+            record("sphere");
+            triple(s.center0);
+        }
+        number(s.radius);
+        number(s.material);
+        line += '\n';
+    }
+
+    for (const auto& l : scene.point_lights) {
+        record("point_light");
+        triple(l.position);
+        triple(l.intensity);
+        line += '\n';
+    }
+
+    for (size_t k = 0; k < scene.meshes.size(); ++k) {
+        const auto& mesh = scene.meshes[k];
+        if (mesh.path.empty()) {
+            error = "mesh " + std::to_string(k) + " has no file to refer to";
+            return false;
+        }
+        auto path = std::filesystem::absolute(mesh.path).string();
+        if (path.find_first_of("#\n") != std::string::npos) {
+            error = "the path of mesh " + std::to_string(k) + " cannot be written to text";
+            return false;
+        }
+        record("mesh");
+        number(mesh.material);
+        triple(mesh.base);
+        number(mesh.height);
+        line += ' ';
+        line += path;
+        line += '\n';
+    }
+
+    flush();
+    return true;
+}
+
+inline void write_scene_binary(std::ostream& out, const scene_description& scene) {
+    scene_file_header header = {};
+    std::memcpy(header.magic, scene_file_magic, sizeof(header.magic));
+    header.version = scene_file_version;
+    header.image_width = scene.image_width;
+    header.samples_per_pixel = scene.samples_per_pixel;
+    header.material_count = static_cast<uint32_t>(scene.materials.size());
+    header.sphere_count = scene.spheres.size();
+    header.point_light_count = static_cast<uint32_t>(scene.point_lights.size());
+    header.mesh_count = static_cast<uint32_t>(scene.meshes.size());
+    header.aspect_ratio = scene.aspect_ratio;
+    header.time0 = scene.time0;
+    header.time1 = scene.time1;
+    from_point3(scene.view.lookfrom, header.lookfrom);
+    from_point3(scene.view.lookat, header.lookat);
+    from_point3(scene.view.vup, header.vup);
+    header.vfov = scene.view.vfov;
+    header.aperture = scene.view.aperture;
+    header.focus_dist = scene.view.focus_dist;
+    header.sky = scene.sky;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& m : scene.materials) {
+        scene_file_material r = {};
+        r.type = static_cast<uint32_t>(m.type);
+        from_point3(m.albedo, r.albedo);
+        r.fuzz = m.fuzz;
+        r.ref_idx = m.ref_idx;
+        out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+
+    for (const auto& s : scene.spheres) {
+        scene_file_sphere r = {};
+        from_point3(s.center0, r.center0);
+        from_point3(s.center1, r.center1);
+        r.time0 = s.time0;
+        r.time1 = s.time1;
+        r.radius = s.radius;
+        r.material = s.material;
+        r.moving = s.moving;
+        out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+
+    for (const auto& l : scene.point_lights) {
+        scene_file_point_light r = {};
+        from_point3(l.position, r.position);
+        from_point3(l.intensity, r.intensity);
+        out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+
+    // The vertices and indices of the meshes follow their records.
+    uint64_t offset = sizeof(header) + scene.materials.size() * sizeof(scene_file_material)
+                    + scene.spheres.size() * sizeof(scene_file_sphere)
+                    + scene.point_lights.size() * sizeof(scene_file_point_light)
+                    + scene.meshes.size() * sizeof(scene_file_mesh);
+    auto align = [](uint64_t n) { return (n + 7) & ~uint64_t(7); };
+    for (const auto& mesh : scene.meshes) {
+        scene_file_mesh r = {};
+        r.material = mesh.material;
+        r.vertex_count = mesh.positions.size();
+        r.triangle_count = mesh.indices.size() / 3;
+        r.vertex_offset = offset;
+        r.index_offset = r.vertex_offset + r.vertex_count * 3 * sizeof(double);
+        offset = align(r.index_offset + r.triangle_count * 3 * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+
+    const char padding[8] = {};
+    for (const auto& mesh : scene.meshes) {
+        for (const auto& p : mesh.positions) {
+            double v[3];
+            from_point3(p, v);
+            out.write(reinterpret_cast<const char*>(v), sizeof(v));
+        }
+        auto index_bytes = (mesh.indices.size() / 3) * 3 * sizeof(uint32_t);
+        out.write(reinterpret_cast<const char*>(mesh.indices.data()), index_bytes);
+        out.write(padding, align(index_bytes) - index_bytes);
+    }
+}
+
+bool save_scene(const std::string& path, const scene_description& scene) {
+    auto binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".rtb") == 0;
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Cannot write " << path << '\n';
+        return false;
+    }
+
+    std::string error;
+    if (binary) {
+        write_scene_binary(out, scene);
+    } else if (!write_scene_text(out, scene, error)) {
+        std::cerr << path << ": " << error << '\n';
+        return false;
+    }
+
+    if (!out) {
+        std::cerr << "Cannot write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// A thin wrapper over the widest float vector the compiler targets: AVX (8
+// lanes), SSE (4 lanes) or a plain array when neither is available. Kernels
+// are written once against vfloat/vmask and loop over simd_width lanes.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RT_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RT_SIMD_SSE 1
+#endif
+
+#if RT_SIMD_AVX
+
+const int simd_width = 8;
+
+struct vmask {
+    __m256 m;
+};
+
+struct vfloat {
+    vfloat() {}
+    vfloat(__m256 x) : v(x) {}
+    vfloat(float x) : v(_mm256_set1_ps(x)) {}
+
+    static vfloat load(const float* p) { return _mm256_load_ps(p); }
+    static vfloat loadu(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_store_ps(p, v); }
+
+    __m256 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+
+inline vmask operator<(vfloat a, vfloat b)  { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline vmask operator<=(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline vmask operator>(vfloat a, vfloat b)  { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline vmask operator>=(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline vmask operator&(vmask a, vmask b) { return {_mm256_and_ps(a.m, b.m)}; }
+inline vmask operator|(vmask a, vmask b) { return {_mm256_or_ps(a.m, b.m)}; }
+
+inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+inline int movemask(vmask m) { return _mm256_movemask_ps(m.m); }
+
+#elif RT_SIMD_SSE
+
+const int simd_width = 4;
+
+struct vmask {
+    __m128 m;
+};
+
+struct vfloat {
+    vfloat() {}
+    vfloat(__m128 x) : v(x) {}
+    vfloat(float x) : v(_mm_set1_ps(x)) {}
+
+    static vfloat load(const float* p) { return _mm_load_ps(p); }
+    static vfloat loadu(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_store_ps(p, v); }
+
+    __m128 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+
+inline vmask operator<(vfloat a, vfloat b)  { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline vmask operator<=(vfloat a, vfloat b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline vmask operator>(vfloat a, vfloat b)  { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline vmask operator>=(vfloat a, vfloat b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+inline vmask operator&(vmask a, vmask b) { return {_mm_and_ps(a.m, b.m)}; }
+inline vmask operator|(vmask a, vmask b) { return {_mm_or_ps(a.m, b.m)}; }
+
+inline vfloat select(vmask m, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+}
+inline int movemask(vmask m) { return _mm_movemask_ps(m.m); }
+
+#else
+
+const int simd_width = 4;
+
+struct vmask {
+    bool m[simd_width];
+};
+
+struct vfloat {
+    vfloat() {}
+    vfloat(float x) { for (int i = 0; i < simd_width; i++) v[i] = x; }
+
+    static vfloat load(const float* p) {
+        vfloat r;
+        for (int i = 0; i < simd_width; i++) r.v[i] = p[i];
+        return r;
+    }
+    static vfloat loadu(const float* p) { return load(p); }
+    void store(float* p) const { for (int i = 0; i < simd_width; i++) p[i] = v[i]; }
+
+    float v[simd_width];
+};
+
+#define RT_SIMD_BINARY(name, expr) \
+    inline vfloat name(vfloat a, vfloat b) { \
+        vfloat r; \
+        for (int i = 0; i < simd_width; i++) r.v[i] = (expr); \
+        return r; \
+    }
+RT_SIMD_BINARY(operator+, a.v[i] + b.v[i])
+RT_SIMD_BINARY(operator-, a.v[i] - b.v[i])
+RT_SIMD_BINARY(operator*, a.v[i] * b.v[i])
+RT_SIMD_BINARY(operator/, a.v[i] / b.v[i])
+RT_SIMD_BINARY(vmin, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+RT_SIMD_BINARY(vmax, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef RT_SIMD_BINARY
+
+#define RT_SIMD_COMPARE(name, op) \
+    inline vmask name(vfloat a, vfloat b) { \
+        vmask r; \
+        for (int i = 0; i < simd_width; i++) r.m[i] = a.v[i] op b.v[i]; \
+        return r; \
+    }
+RT_SIMD_COMPARE(operator<, <)
+RT_SIMD_COMPARE(operator<=, <=)
+RT_SIMD_COMPARE(operator>, >)
+RT_SIMD_COMPARE(operator>=, >=)
+#undef RT_SIMD_COMPARE
+
+inline vfloat operator-(vfloat a) { return vfloat(0.0f) - a; }
+
+inline vfloat vsqrt(vfloat a) {
+    for (int i = 0; i < simd_width; i++) a.v[i] = std::sqrt(a.v[i]);
+    return a;
+}
+
+inline vmask operator&(vmask a, vmask b) {
+    for (int i = 0; i < simd_width; i++) a.m[i] = a.m[i] && b.m[i];
+    return a;
+}
+
+inline vmask operator|(vmask a, vmask b) {
+    for (int i = 0; i < simd_width; i++) a.m[i] = a.m[i] || b.m[i];
+    return a;
+}
+
+inline vfloat select(vmask m, vfloat a, vfloat b) {
+    for (int i = 0; i < simd_width; i++) a.v[i] = m.m[i] ? a.v[i] : b.v[i];
+    return a;
+}
+
+inline int movemask(vmask m) {
+    int bits = 0;
+    for (int i = 0; i < simd_width; i++) bits |= m.m[i] << i;
+    return bits;
+}
+
+#endif
+
+inline bool any(vmask m) { return movemask(m) != 0; }
+
+// Index of the lowest set bit of a non-zero movemask.
+inline int count_trailing_zeros(int bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(static_cast<unsigned int>(bits));
+#else
+    int n = 0;
+    while (!(bits & 1)) { bits >>= 1; n++; }
+    return n;
+#endif
+}
+
+// Allocates storage aligned for vector loads, for structure-of-arrays buffers.
+template <typename T, size_t Alignment = 64>
+class aligned_allocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = aligned_allocator<U, Alignment>; };
+
+    aligned_allocator() noexcept {}
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, Alignment>&) const noexcept { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+#endif
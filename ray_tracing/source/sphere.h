@@ -4,23 +4,63 @@
 #include "hittable.h"
 #include "vec3.h"
 
+// Fills rec for a hit of r at parameter t on a sphere. r.at(t) can be off the
+// surface by a lot more than the sphere's own rounding error, so the point is
+// projected back onto the sphere first.
+inline void set_sphere_hit(
+    hit_record& rec, const ray& r, real t, const point3& center, real radius
+) {
+    auto radius_abs = fabs(radius);
+    auto offset = r.at(t) - center;
+    offset *= radius_abs / offset.length();
+
+    rec.t = t;
+    rec.p = center + offset;
+    rec.error = rounding_error(8) * (
+        fmax(fabs(center.x()), fmax(fabs(center.y()), fabs(center.z()))) + radius_abs);
+    rec.set_face_normal(r, offset / radius);
+}
+
+// Whether r meets the sphere at some t in (t_min, t_max), with the arithmetic
+// of sphere::hit so that both always agree.
+inline bool sphere_occludes(
+    const ray& r, real t_min, real t_max, const point3& center, real radius
+) {
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant <= 0)
+        return false;
+
+    auto root = sqrt(discriminant);
+    auto temp = (-half_b - root) / a;
+    if (temp < t_max && temp > t_min)
+        return true;
+    temp = (-half_b + root) / a;
+    return temp < t_max && temp > t_min;
+}
+
 class sphere : public hittable {
 public:
     sphere() {}
-    sphere(point3 cen, double r, shared_ptr<material> m)
-        : center(cen), radius(r), mat_ptr(m) {}
+    sphere(point3 cen, real r, uint32_t m)
+        : center(cen), radius(r), material_id(m) {}
 
     virtual bool hit(
-        const ray& r, double tmin, double tmax, hit_record& rec) const override;
-    virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
 
 public:
     point3 center;
-    double radius;
-    shared_ptr<material> mat_ptr;
+    real radius;
+    uint32_t material_id;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    add_count(counter::primitive_tests);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -32,21 +72,15 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 
         auto temp = (-half_b - root) / a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            set_sphere_hit(rec, r, temp, center, radius);
+            rec.material_id = material_id;
             return true;
         }
 
         temp = (-half_b + root) / a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            set_sphere_hit(rec, r, temp, center, radius);
+            rec.material_id = material_id;
             return true;
         }
     }
@@ -54,7 +88,12 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     return false;
 }
 
-bool sphere::bounding_box(double t0, double t1, aabb& output_box) const {
+bool sphere::occluded(const ray& r, real t_min, real t_max) const {
+    add_count(counter::primitive_tests);
+    return sphere_occludes(r, t_min, t_max, center, radius);
+}
+
+bool sphere::bounding_box(real t0, real t1, aabb& output_box) const {
     output_box = aabb(
         center - vec3(radius, radius, radius),
         center + vec3(radius, radius, radius));
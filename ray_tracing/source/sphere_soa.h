@@ -0,0 +1,275 @@
+#ifndef SPHERE_SOA_H
+#define SPHERE_SOA_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+#include "simd.h"
+
+#include <cstdint>
+#include <vector>
+
+// A buffer of spheres in structure-of-arrays layout with its own BVH. Static
+// and moving spheres share one representation, center(t) = center + t*velocity,
+// and materials are referenced by index. The BVH is built with leaves of at most
+// simd_width spheres, so one vector kernel tests a whole leaf against the ray.
+class sphere_soa : public hittable {
+public:
+    sphere_soa() {}
+
+    void add(point3 center, real radius, uint32_t material_index);
+    void add(
+        point3 center0, point3 center1, real time0, real time1,
+        real radius, uint32_t material_index);
+
+    // Builds the BVH and reorders the spheres so that every leaf is contiguous.
+    // Must be called after the last add() and before the first hit().
+    void build(real time0, real time1, bvh_build_options options = bvh_build_options());
+
+    virtual bool hit(
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    size_t size() const { return material_index.size(); }
+
+    // Bytes held by the sphere arrays and the BVH.
+    size_t memory_usage() const;
+
+    // Counts every sphere of a leaf the ray reaches as tested.
+    bool hit_counted(
+        const ray& r, real tmin, real tmax, hit_record& rec, traversal_stats& stats) const {
+        return traverse(r, tmin, tmax, rec, stats);
+    }
+
+private:
+    template <typename Stats>
+    bool traverse(const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats) const;
+    int hit_leaf(const ray& r, uint32_t first, uint32_t count, real t_min, real& closest) const;
+    point3 center(uint32_t index, real time) const;
+    real intersect(uint32_t index, const ray& r, real t_min, real t_max) const;
+    bool hit_sphere(uint32_t index, const ray& r, real t_min, real t_max, hit_record& rec) const;
+
+public:
+    aligned_vector<float> center_x, center_y, center_z;
+    aligned_vector<float> velocity_x, velocity_y, velocity_z;
+    aligned_vector<float> radius;
+    std::vector<uint32_t> material_index;
+    std::vector<linear_bvh_node> nodes;
+    aabb box;
+};
+
+void sphere_soa::add(point3 center, real r, uint32_t m) {
+    add(center, center, 0, 1, r, m);
+}
+
+void sphere_soa::add(
+    point3 center0, point3 center1, real time0, real time1, real r, uint32_t m
+) {
+    auto velocity = (center1 - center0) / (time1 - time0);
+    auto center = center0 - time0 * velocity;
+
+    center_x.push_back(static_cast<float>(center.x()));
+    center_y.push_back(static_cast<float>(center.y()));
+    center_z.push_back(static_cast<float>(center.z()));
+    velocity_x.push_back(static_cast<float>(velocity.x()));
+    velocity_y.push_back(static_cast<float>(velocity.y()));
+    velocity_z.push_back(static_cast<float>(velocity.z()));
+    radius.push_back(static_cast<float>(r));
+    material_index.push_back(m);
+}
+
+void sphere_soa::build(real time0, real time1, bvh_build_options options) {
+    auto n = size();
+    if (n == 0)
+        return;
+    std::vector<aabb> bounds(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        point3 c(center_x[i], center_y[i], center_z[i]);
+        vec3 v(velocity_x[i], velocity_y[i], velocity_z[i]);
+        vec3 r(radius[i], radius[i], radius[i]);
+        bounds[i] = surrounding_box(
+            aabb(c + time0*v - r, c + time0*v + r),
+            aabb(c + time1*v - r, c + time1*v + r));
+        box = i == 0 ? bounds[i] : surrounding_box(box, bounds[i]);
+    }
+
+    // One kernel call tests a whole leaf, so relative to a node visit a sphere
+    // costs about 1/simd_width of a scalar primitive test.
+    options.max_leaf_size = simd_width;
+    options.traversal_cost = simd_width;
+    std::vector<uint32_t> order;
+    build_sah_bvh(bounds, options, nodes, order);
+    bounds.clear();
+    bounds.shrink_to_fit();
+
+    auto permute = [&](auto& values) {
+        auto copy = values;
+        for (size_t i = 0; i < n; ++i)
+            values[i] = copy[order[i]];
+    };
+    permute(center_x); permute(center_y); permute(center_z);
+    permute(velocity_x); permute(velocity_y); permute(velocity_z);
+    permute(radius);
+    permute(material_index);
+
+    // Pad the float arrays so that a full vector load from the last leaf stays
+    // in bounds. Padding spheres have zero radius and are masked off anyway.
+    for (auto* values : {&center_x, &center_y, &center_z,
+                         &velocity_x, &velocity_y, &velocity_z, &radius}) {
+        values->insert(values->end(), simd_width, 0.0f);
+        values->shrink_to_fit();
+    }
+    material_index.shrink_to_fit();
+}
+
+size_t sphere_soa::memory_usage() const {
+    return 7 * radius.capacity() * sizeof(float)
+         + material_index.capacity() * sizeof(uint32_t)
+         + nodes.capacity() * sizeof(linear_bvh_node);
+}
+
+bool sphere_soa::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    no_traversal_stats stats;
+    return traverse(r, t_min, t_max, rec, stats);
+}
+
+template <typename Stats>
+bool sphere_soa::traverse(
+    const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats
+) const {
+    int closest_index = -1;
+
+    traverse_bvh(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            stats.test_primitives(count);
+            auto index = hit_leaf(r, first, count, t_min, closest_so_far);
+            if (index < 0)
+                return false;
+            closest_index = index;
+            return true;
+        });
+
+    return closest_index >= 0 && hit_sphere(closest_index, r, t_min, t_max, rec);
+}
+
+bool sphere_soa::occluded(const ray& r, real t_min, real t_max) const {
+    no_traversal_stats stats;
+    return traverse_bvh<true>(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            return hit_leaf(r, first, count, t_min, closest_so_far) >= 0;
+        });
+}
+
+// Tests one ray against count spheres starting at first, simd_width at a time,
+// and returns the closest one hit in (t_min, closest), or -1.
+//
+// Single precision is not enough to decide hits close to the surface of large
+// spheres (the ground of random_scene has radius 1000), so the vector kernel
+// only picks candidates with some tolerance. The few candidates it finds are
+// confirmed with the same arithmetic as sphere, so the results agree.
+int sphere_soa::hit_leaf(
+    const ray& r, uint32_t first, uint32_t count, real t_min, real& closest
+) const {
+    const vfloat ox(static_cast<float>(r.origin().x()));
+    const vfloat oy(static_cast<float>(r.origin().y()));
+    const vfloat oz(static_cast<float>(r.origin().z()));
+    const vfloat dx(static_cast<float>(r.direction().x()));
+    const vfloat dy(static_cast<float>(r.direction().y()));
+    const vfloat dz(static_cast<float>(r.direction().z()));
+    const vfloat t(static_cast<float>(r.time()));
+    const vfloat tmin(static_cast<float>(t_min));
+    const vfloat tolerance(1e-3f);
+    const vfloat inv_a(static_cast<float>(1.0 / r.direction().length_squared()));
+
+    int closest_index = -1;
+    add_count(counter::primitive_tests, count);
+
+    for (uint32_t base = first; base < first + count; base += simd_width) {
+        auto ocx = ox - (vfloat::loadu(&center_x[base]) + t * vfloat::loadu(&velocity_x[base]));
+        auto ocy = oy - (vfloat::loadu(&center_y[base]) + t * vfloat::loadu(&velocity_y[base]));
+        auto ocz = oz - (vfloat::loadu(&center_z[base]) + t * vfloat::loadu(&velocity_z[base]));
+        auto rad = vfloat::loadu(&radius[base]);
+
+        // r^2 - |oc - (b/a)d|^2 rather than b^2 - ac, which cancels badly in
+        // single precision for grazing rays.
+        auto proj = (ocx*dx + ocy*dy + ocz*dz) * inv_a;
+        auto lx = ocx - proj*dx;
+        auto ly = ocy - proj*dy;
+        auto lz = ocz - proj*dz;
+        auto discriminant = rad*rad - (lx*lx + ly*ly + lz*lz);
+
+        auto root = vsqrt(vmax(discriminant, vfloat(0.0f)) * inv_a);
+        auto error = tolerance * (vmax(proj, -proj) + root);
+        auto limit = vfloat(static_cast<float>(closest));
+        auto candidates = (discriminant > -tolerance * rad*rad)
+                        & (-proj + root + error > tmin)
+                        & (-proj - root - error < limit);
+        auto mask = movemask(candidates);
+
+        auto lanes = first + count - base;
+        if (lanes < static_cast<uint32_t>(simd_width))
+            mask &= (1 << lanes) - 1;
+
+        for (; mask; mask &= mask - 1) {
+            auto index = base + count_trailing_zeros(mask);
+            auto t_hit = intersect(index, r, t_min, closest);
+            if (t_hit > 0) {
+                closest = t_hit;
+                closest_index = static_cast<int>(index);
+            }
+        }
+    }
+
+    return closest_index;
+}
+
+point3 sphere_soa::center(uint32_t index, real time) const {
+    return point3(
+        center_x[index] + time * velocity_x[index],
+        center_y[index] + time * velocity_y[index],
+        center_z[index] + time * velocity_z[index]);
+}
+
+// Returns the first root in (t_min, t_max), or zero.
+real sphere_soa::intersect(uint32_t index, const ray& r, real t_min, real t_max) const {
+    vec3 oc = r.origin() - center(index, r.time());
+    real rad = radius[index];
+
+    auto a = r.direction().length_squared();
+    auto proj = dot(oc, r.direction()) / a;
+    auto l = oc - proj * r.direction();
+    auto discriminant = rad*rad - l.length_squared();
+    if (discriminant <= 0)
+        return 0;
+
+    auto root = sqrt(discriminant / a);
+    auto temp = -proj - root;
+    if (temp < t_max && temp > t_min)
+        return temp;
+    temp = -proj + root;
+    if (temp < t_max && temp > t_min)
+        return temp;
+    return 0;
+}
+
+bool sphere_soa::hit_sphere(
+    uint32_t index, const ray& r, real t_min, real t_max, hit_record& rec
+) const {
+    auto t_hit = intersect(index, r, t_min, t_max);
+    if (t_hit <= 0)
+        return false;
+
+    set_sphere_hit(rec, r, t_hit, center(index, r.time()), radius[index]);
+    rec.material_id = material_index[index];
+    return true;
+}
+
+bool sphere_soa::bounding_box(real t0, real t1, aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+// An affine transform, stored as the top three rows of a 4x4 matrix acting on
+// column vectors: p' = m * (p, 1).
+struct transform {
+    real m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+    static transform translate(const vec3& offset);
+    static transform scale(real factor);
+    // Counterclockwise about axis, looking down it.
+    static transform rotate(const vec3& axis, real degrees);
+
+    point3 apply_point(const point3& p) const {
+        return point3(
+            m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+            m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+            m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(
+            m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+            m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+            m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+
+    // Maps a normal of the space this transform maps from, given the inverse
+    // transform, since normals go with the inverse transpose.
+    static vec3 apply_normal(const transform& inverse, const vec3& n) {
+        return vec3(
+            inverse.m[0][0]*n.x() + inverse.m[1][0]*n.y() + inverse.m[2][0]*n.z(),
+            inverse.m[0][1]*n.x() + inverse.m[1][1]*n.y() + inverse.m[2][1]*n.z(),
+            inverse.m[0][2]*n.x() + inverse.m[1][2]*n.y() + inverse.m[2][2]*n.z());
+    }
+
+    // Bound on how much apply_point can stretch a distance, the largest row
+    // sum of the absolute linear part.
+    real max_stretch() const;
+
+    aabb apply_box(const aabb& box) const;
+
+    transform inverse() const;
+};
+
+// a * b applies b first.
+inline transform operator*(const transform& a, const transform& b) {
+    transform c;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            c.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+        }
+        c.m[i][3] += a.m[i][3];
+    }
+    return c;
+}
+
+transform transform::translate(const vec3& offset) {
+    transform t;
+    for (int i = 0; i < 3; i++)
+        t.m[i][3] = offset[i];
+    return t;
+}
+
+transform transform::scale(real factor) {
+    transform t;
+    for (int i = 0; i < 3; i++)
+        t.m[i][i] = factor;
+    return t;
+}
+
+transform transform::rotate(const vec3& axis, real degrees) {
+    auto a = unit_vector(axis);
+    auto theta = degrees_to_radians(degrees);
+    auto s = sin(theta), c = cos(theta);
+
+    transform t;
+    t.m[0][0] = a.x()*a.x() + (1 - a.x()*a.x())*c;
+    t.m[0][1] = a.x()*a.y()*(1 - c) - a.z()*s;
+    t.m[0][2] = a.x()*a.z()*(1 - c) + a.y()*s;
+    t.m[1][0] = a.x()*a.y()*(1 - c) + a.z()*s;
+    t.m[1][1] = a.y()*a.y() + (1 - a.y()*a.y())*c;
+    t.m[1][2] = a.y()*a.z()*(1 - c) - a.x()*s;
+    t.m[2][0] = a.x()*a.z()*(1 - c) - a.y()*s;
+    t.m[2][1] = a.y()*a.z()*(1 - c) + a.x()*s;
+    t.m[2][2] = a.z()*a.z() + (1 - a.z()*a.z())*c;
+    return t;
+}
+
+real transform::max_stretch() const {
+    real stretch = 0;
+    for (int i = 0; i < 3; i++)
+        stretch = fmax(stretch, fabs(m[i][0]) + fabs(m[i][1]) + fabs(m[i][2]));
+    return stretch;
+}
+
+// The box around the eight transformed corners, computed per axis as in
+// Arvo's method.
+aabb transform::apply_box(const aabb& box) const {
+    point3 lo, hi;
+    for (int i = 0; i < 3; i++) {
+        lo[i] = hi[i] = m[i][3];
+        for (int j = 0; j < 3; j++) {
+            auto a = m[i][j] * box.min()[j];
+            auto b = m[i][j] * box.max()[j];
+            lo[i] += fmin(a, b);
+            hi[i] += fmax(a, b);
+        }
+    }
+    return aabb(lo, hi);
+}
+
+// The inverse of the linear part by cofactors, then the translation undone.
+transform transform::inverse() const {
+    auto det = m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+             - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+             + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+    auto inv_det = 1 / det;
+
+    transform r;
+    r.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+    r.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+    r.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+    r.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+    r.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+    r.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+    r.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+    r.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+    r.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = -(r.m[i][0]*m[0][3] + r.m[i][1]*m[1][3] + r.m[i][2]*m[2][3]);
+    return r;
+}
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// An indexed triangle mesh: triangles are triples of indices into one shared
+// vertex buffer. Like sphere_soa, the mesh carries its own BVH with one
+// primitive per triangle, so a mesh of millions of triangles is a single
+// object to the rest of the scene and no triangle needs an object of its own.
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh() {}
+    triangle_mesh(std::vector<point3> p, std::vector<uint32_t> i, uint32_t m)
+        : positions(std::move(p)), indices(std::move(i)), material_id(m) {}
+
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    // Builds the BVH and reorders the triangles so that every leaf is
+    // contiguous. Must be called after the last change to positions or indices
+    // and before the first hit().
+    void build(bvh_build_options options = bvh_build_options());
+
+    // Refits the BVH after positions have changed but indices have not, for
+    // meshes that deform from frame to frame.
+    void refit();
+
+    // Refits, or rebuilds once the refitted tree would cost more than
+    // max_cost_growth times what it cost when built. Returns whether it rebuilt.
+    bool update(double max_cost_growth = 1.5);
+
+    virtual bool hit(
+        const ray& r, real tmin, real tmax, hit_record& rec) const override;
+    virtual bool bounding_box(real t0, real t1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    // Bytes held by the vertex and index buffers and the BVH.
+    size_t memory_usage() const;
+
+    bool hit_counted(
+        const ray& r, real tmin, real tmax, hit_record& rec, traversal_stats& stats) const {
+        return traverse(r, tmin, tmax, rec, stats);
+    }
+
+private:
+    template <typename Stats>
+    bool traverse(const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats) const;
+    struct triangle_hit {
+        real t;
+        real b0, b1, b2; // barycentric weights of the three vertices
+    };
+
+    bool intersect(uint32_t triangle, const ray& r, real t_min, real t_max, triangle_hit& hit) const;
+    aabb triangle_box(size_t triangle) const;
+
+public:
+    std::vector<point3> positions;
+    std::vector<uint32_t> indices; // three per triangle
+    uint32_t material_id = 0;
+    std::vector<linear_bvh_node> nodes;
+    aabb box;
+    double built_cost = 0; // bvh_sah_cost() after the last build
+    bvh_build_options build_options;
+};
+
+void triangle_mesh::build(bvh_build_options options) {
+    auto n = triangle_count();
+    if (n == 0)
+        return;
+    std::vector<aabb> bounds(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        bounds[i] = triangle_box(i);
+        box = i == 0 ? bounds[i] : surrounding_box(box, bounds[i]);
+    }
+
+    std::vector<uint32_t> order;
+    build_sah_bvh(bounds, options, nodes, order);
+    bounds.clear();
+    bounds.shrink_to_fit();
+
+    std::vector<uint32_t> sorted(indices.size());
+    for (size_t i = 0; i < n; ++i)
+        for (int k = 0; k < 3; ++k)
+            sorted[3*i + k] = indices[3*size_t(order[i]) + k];
+    indices.swap(sorted);
+    positions.shrink_to_fit();
+    built_cost = bvh_sah_cost(nodes);
+    build_options = options;
+}
+
+aabb triangle_mesh::triangle_box(size_t i) const {
+    const auto& p0 = positions[indices[3*i]];
+    const auto& p1 = positions[indices[3*i + 1]];
+    const auto& p2 = positions[indices[3*i + 2]];
+    point3 lo(fmin(p0.x(), fmin(p1.x(), p2.x())),
+              fmin(p0.y(), fmin(p1.y(), p2.y())),
+              fmin(p0.z(), fmin(p1.z(), p2.z())));
+    point3 hi(fmax(p0.x(), fmax(p1.x(), p2.x())),
+              fmax(p0.y(), fmax(p1.y(), p2.y())),
+              fmax(p0.z(), fmax(p1.z(), p2.z())));
+    return aabb(lo, hi);
+}
+
+void triangle_mesh::refit() {
+    bool first_leaf = true;
+    refit_bvh(nodes, [&](uint32_t first, uint32_t count) {
+        aabb leaf_box = triangle_box(first);
+        for (auto i = first + 1; i < first + count; ++i)
+            leaf_box = surrounding_box(leaf_box, triangle_box(i));
+        box = first_leaf ? leaf_box : surrounding_box(box, leaf_box);
+        first_leaf = false;
+        return leaf_box;
+    });
+}
+
+bool triangle_mesh::update(double max_cost_growth) {
+    refit();
+    if (bvh_sah_cost(nodes) <= max_cost_growth * built_cost)
+        return false;
+    build(build_options);
+    return true;
+}
+
+bool triangle_mesh::occluded(const ray& r, real t_min, real t_max) const {
+    no_traversal_stats stats;
+    triangle_hit hit;
+    return traverse_bvh<true>(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            for (uint32_t i = first; i < first + count; ++i) {
+                if (intersect(i, r, t_min, closest_so_far, hit))
+                    return true;
+            }
+            return false;
+        });
+}
+
+size_t triangle_mesh::memory_usage() const {
+    return positions.capacity() * sizeof(point3)
+         + indices.capacity() * sizeof(uint32_t)
+         + nodes.capacity() * sizeof(linear_bvh_node);
+}
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    no_traversal_stats stats;
+    return traverse(r, t_min, t_max, rec, stats);
+}
+
+template <typename Stats>
+bool triangle_mesh::traverse(
+    const ray& r, real t_min, real t_max, hit_record& rec, Stats& stats
+) const {
+    int64_t closest_triangle = -1;
+    triangle_hit closest;
+
+    traverse_bvh(nodes.data(), nodes.size(), r, t_min, t_max, stats,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            bool hit_anything = false;
+            for (uint32_t i = first; i < first + count; ++i) {
+                stats.test_primitive();
+                if (intersect(i, r, t_min, closest_so_far, closest)) {
+                    hit_anything = true;
+                    closest_so_far = closest.t;
+                    closest_triangle = i;
+                }
+            }
+            return hit_anything;
+        });
+
+    if (closest_triangle < 0)
+        return false;
+
+    const auto& p0 = positions[indices[3*closest_triangle]];
+    const auto& p1 = positions[indices[3*closest_triangle + 1]];
+    const auto& p2 = positions[indices[3*closest_triangle + 2]];
+
+    // The point is interpolated from the vertices rather than taken from
+    // r.at(t), which keeps it within a few ulps of the plane of the triangle.
+    rec.t = closest.t;
+    rec.p = closest.b0 * p0 + closest.b1 * p1 + closest.b2 * p2;
+    auto magnitude = [&](int a) {
+        return fabs(closest.b0 * p0[a]) + fabs(closest.b1 * p1[a]) + fabs(closest.b2 * p2[a]);
+    };
+    rec.error = rounding_error(7) * fmax(magnitude(0), fmax(magnitude(1), magnitude(2)));
+    rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+    rec.material_id = material_id;
+    return true;
+}
+
+// The watertight test of Woop, Benthin and Wald (JCGT 2013). The vertices are
+// moved into a space where the ray starts at the origin and runs along +z, and
+// the hit is decided by the signs of the 2D edge functions there. Rays through
+// a shared edge or vertex hit at least one of the triangles around it, so
+// closed meshes have no cracks. The t test is the conservative one from PBRT,
+// which rejects hits closer than the rounding error of t itself.
+bool triangle_mesh::intersect(
+    uint32_t triangle, const ray& r, real t_min, real t_max, triangle_hit& hit
+) const {
+    add_count(counter::primitive_tests);
+    const auto& d = r.direction();
+
+    // Permute so that z is the largest component of the direction.
+    int kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2)
+                                       : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+    int kx = kz == 2 ? 0 : kz + 1;
+    int ky = kx == 2 ? 0 : kx + 1;
+    if (d[kz] < 0)
+        std::swap(kx, ky);
+
+    auto sz = 1 / d[kz];
+    auto sx = d[kx] * sz;
+    auto sy = d[ky] * sz;
+
+    auto a = positions[indices[3*triangle]] - r.origin();
+    auto b = positions[indices[3*triangle + 1]] - r.origin();
+    auto c = positions[indices[3*triangle + 2]] - r.origin();
+
+    auto ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+    auto bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+    auto cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+
+    auto e0 = bx * cy - by * cx;
+    auto e1 = cx * ay - cy * ax;
+    auto e2 = ax * by - ay * bx;
+
+#if RT_USE_FLOAT
+    // Exactly zero in single precision is too coarse to tell which side of an
+    // edge the ray passes, so those are decided in double.
+    if (e0 == 0 || e1 == 0 || e2 == 0) {
+        e0 = static_cast<real>(double(bx) * cy - double(by) * cx);
+        e1 = static_cast<real>(double(cx) * ay - double(cy) * ax);
+        e2 = static_cast<real>(double(ax) * by - double(ay) * bx);
+    }
+#endif
+
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+        return false;
+    auto det = e0 + e1 + e2;
+    if (det == 0)
+        return false;
+
+    auto az = sz * a[kz], bz = sz * b[kz], cz = sz * c[kz];
+    auto t_scaled = e0 * az + e1 * bz + e2 * cz;
+    if (det < 0 ? (t_scaled >= t_min * det || t_scaled < t_max * det)
+                : (t_scaled <= t_min * det || t_scaled > t_max * det))
+        return false;
+
+    auto inv_det = 1 / det;
+    auto t = t_scaled * inv_det;
+
+    // Bound the error of t and require it to be positive beyond that.
+    auto max_z = fmax(fabs(az), fmax(fabs(bz), fabs(cz)));
+    auto max_x = fmax(fabs(ax), fmax(fabs(bx), fabs(cx)));
+    auto max_y = fmax(fabs(ay), fmax(fabs(by), fabs(cy)));
+    auto max_e = fmax(fabs(e0), fmax(fabs(e1), fabs(e2)));
+    auto delta_z = rounding_error(3) * max_z;
+    auto delta_x = rounding_error(5) * (max_x + max_z);
+    auto delta_y = rounding_error(5) * (max_y + max_z);
+    auto delta_e = 2 * (rounding_error(2) * max_x * max_y + delta_y * max_x + delta_x * max_y);
+    auto delta_t = 3 * (rounding_error(3) * max_e * max_z + delta_e * max_z + delta_z * max_e)
+                 * fabs(inv_det);
+    if (t <= delta_t)
+        return false;
+
+    hit.t = t;
+    hit.b0 = e0 * inv_det;
+    hit.b1 = e1 * inv_det;
+    hit.b2 = e2 * inv_det;
+    return true;
+}
+
+bool triangle_mesh::bounding_box(real t0, real t1, aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+#endif
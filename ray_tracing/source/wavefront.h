@@ -0,0 +1,331 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "linear_bvh.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Traces the samples of a tile breadth first instead of path by path. All the
+// paths of a batch live in one queue, and each bounce runs as a sequence of
+// stages over the whole queue:
+//
+//   extend  sort the rays by direction octant and find their closest hits,
+//           in packets when --packet is given; paths that escape pick up
+//           the background and end
+//   shade   sort the hits by bounce_type, add the light they emit and
+//           scatter them, with the same depth limits, Russian roulette and
+//           light samples as path_integrator
+//   shadow  trace the shadow rays of those light samples, which only need
+//           occluded(), and add the light of the ones that get through
+//
+// Every path carries its own generator, seeded like the megakernel's and drawn
+// from in the same order, so both engines trace exactly the same paths.
+class wavefront_integrator {
+public:
+    wavefront_integrator(
+        const hittable& w, const material_table& m, const light_list& l, const camera& c,
+        const path_depths& d, int width, int height, uint64_t s, uint32_t f,
+        const linear_bvh* packets = nullptr, int packet_count = 0)
+        : world(w), materials(m), lights(l), cam(c), depths(d), image_width(width), image_height(height),
+          seed(s), frame(f), packet_world(packets), packet_size(packet_count) {}
+
+    // Takes sample_count(i, j) more samples in every pixel (i, j) of t, numbered
+    // on from the pixel's count in samples, adds them to samples and returns the
+    // number of rays traced.
+    template <typename SampleCount>
+    uint64_t render_tile(const tile& t, accumulation_buffer& samples, SampleCount sample_count) const;
+
+private:
+    struct path {
+        ray r;
+        color throughput;
+        pcg32 rng;
+        uint32_t pixel;  // index into batch.pixels
+        int depth;       // rays traced so far
+        int bounces[bounce_type_count];
+        bounce_origin from;
+        color radiance;  // gathered so far
+    };
+
+    struct batch_pixel {
+        int i, j;
+        int first_sample, sample_count;
+        color sum;
+        real square_sum;
+    };
+
+    struct batch {
+        std::vector<batch_pixel> pixels;
+        std::vector<path> paths;
+        std::vector<hit_record> hits; // parallel to paths
+        std::vector<uint32_t> active, sorted; // indices into paths
+        std::vector<uint32_t> key_offsets;
+        std::vector<shadow_query> shadows;
+        std::vector<uint32_t> shadow_paths; // parallel to shadows
+    };
+
+    void generate(batch& b) const;
+    uint64_t extend(batch& b) const;
+    void shade(batch& b) const;
+    uint64_t trace_shadows(batch& b) const;
+    void finish(batch& b, uint32_t index, const color& radiance) const;
+
+    // Stable counting sort of b.active by key(index) in [0, key_count), into
+    // b.sorted.
+    template <typename Key>
+    void sort_active(batch& b, int key_count, Key key) const;
+
+    // Upper bound on the paths of one batch, so that the queues of a tile with
+    // many samples per pass stay around ten megabytes.
+    static const size_t max_batch_paths = 1 << 16;
+
+public:
+    const hittable& world;
+    const material_table& materials;
+    const light_list& lights;
+    const camera& cam;
+    path_depths depths;
+    int image_width, image_height;
+    uint64_t seed;
+    uint32_t frame;
+    const linear_bvh* packet_world;
+    int packet_size;
+};
+
+template <typename SampleCount>
+uint64_t wavefront_integrator::render_tile(
+    const tile& t, accumulation_buffer& samples, SampleCount sample_count
+) const {
+    thread_local batch b;
+    uint64_t rays = 0;
+
+    auto flush = [&] {
+        if (b.pixels.empty())
+            return;
+
+        generate(b);
+        while (!b.active.empty()) {
+            rays += extend(b);
+            shade(b);
+            rays += trace_shadows(b);
+        }
+
+        // Summed in sample order, as the megakernel does, so that both give the
+        // same bits.
+        for (const auto& p : b.paths) {
+            auto& px = b.pixels[p.pixel];
+            px.sum += p.radiance;
+            px.square_sum += luminance(p.radiance) * luminance(p.radiance);
+        }
+        for (const auto& px : b.pixels)
+            samples.add(px.i, px.j, px.sum, px.square_sum, px.sample_count);
+        b.pixels.clear();
+    };
+
+    size_t path_count = 0;
+    for (int j = t.y0; j < t.y1; ++j) {
+        for (int i = t.x0; i < t.x1; ++i) {
+            int n = sample_count(i, j);
+            if (n <= 0)
+                continue;
+            if (path_count + n > max_batch_paths) {
+                flush();
+                path_count = 0;
+            }
+            b.pixels.push_back({i, j, static_cast<int>(samples.sample_count(i, j)), n, color(0, 0, 0), 0});
+            path_count += n;
+        }
+    }
+    flush();
+
+    return rays;
+}
+
+void wavefront_integrator::generate(batch& b) const {
+    b.paths.clear();
+    b.active.clear();
+
+    for (uint32_t k = 0; k < b.pixels.size(); ++k) {
+        const auto& px = b.pixels[k];
+        auto pixel = size_t(px.j) * image_width + px.i;
+        for (int s = px.first_sample; s < px.first_sample + px.sample_count; ++s) {
+            seed_sample(seed, pixel, s, frame);
+            auto u = (px.i+random_double()) / (image_width-1);
+            auto v = (px.j+random_double()) / (image_height-1);
+
+            path p;
+            p.r = cam.get_ray(u, v);
+            p.throughput = color(1, 1, 1);
+            p.rng = thread_rng();
+            p.pixel = k;
+            p.depth = 0;
+            std::fill(p.bounces, p.bounces + bounce_type_count, 0);
+            p.from = {point3(), 0};
+            p.radiance = color(0, 0, 0);
+
+            b.active.push_back(static_cast<uint32_t>(b.paths.size()));
+            b.paths.push_back(p);
+        }
+    }
+    b.hits.resize(b.paths.size());
+}
+
+template <typename Key>
+void wavefront_integrator::sort_active(batch& b, int key_count, Key key) const {
+    b.key_offsets.assign(key_count + 1, 0);
+    for (auto index : b.active)
+        b.key_offsets[key(index) + 1]++;
+    for (int k = 0; k < key_count; ++k)
+        b.key_offsets[k + 1] += b.key_offsets[k];
+
+    b.sorted.resize(b.active.size());
+    for (auto index : b.active)
+        b.sorted[b.key_offsets[key(index)]++] = index;
+}
+
+inline int direction_octant(const vec3& d) {
+    return (d.x() < 0) | (d.y() < 0) << 1 | (d.z() < 0) << 2;
+}
+
+// Finds the closest hit of every active path. Rays that leave in the same
+// octant mostly visit the BVH in the same order, so they are traced next to
+// each other, and together in one packet when packets are enabled. Paths that
+// miss end here. The paths that hit are left in b.active.
+uint64_t wavefront_integrator::extend(batch& b) const {
+    sort_active(b, 8, [&](uint32_t index) { return direction_octant(b.paths[index].r.direction()); });
+    b.active.clear();
+
+    auto trace_one = [&](uint32_t index, bool hit) {
+        auto& p = b.paths[index];
+        add_count(p.depth == 0 ? counter::camera_rays : counter::scatter_rays);
+        p.depth++;
+        if (!hit)
+            finish(b, index, p.throughput * lights.sky_radiance(p.r));
+        else
+            b.active.push_back(index);
+    };
+
+    if (packet_world && packet_size > 0) {
+        ray rays[max_packet_size];
+        hit_record recs[max_packet_size];
+        bool hits[max_packet_size];
+
+        for (size_t k0 = 0; k0 < b.sorted.size(); k0 += packet_size) {
+            auto count = static_cast<int>(std::min<size_t>(packet_size, b.sorted.size() - k0));
+            for (int k = 0; k < count; ++k)
+                rays[k] = b.paths[b.sorted[k0 + k]].r;
+
+            packet_world->hit_packet(rays, count, 0, infinity, recs, hits);
+
+            for (int k = 0; k < count; ++k) {
+                auto index = b.sorted[k0 + k];
+                b.hits[index] = recs[k];
+                trace_one(index, hits[k]);
+            }
+        }
+    } else {
+        for (auto index : b.sorted)
+            trace_one(index, world.hit(b.paths[index].r, 0, infinity, b.hits[index]));
+    }
+
+    return b.sorted.size();
+}
+
+// Scatters every path that hit something, grouped by the kind of bounce so
+// that paths running the same material code are shaded together. Light samples
+// leave their shadow rays in b.shadows.
+void wavefront_integrator::shade(batch& b) const {
+    sort_active(b, bounce_type_count,
+        [&](uint32_t index) { return static_cast<int>(materials[b.hits[index].material_id].bounce()); });
+    b.active.clear();
+    b.shadows.clear();
+    b.shadow_paths.clear();
+
+    for (auto index : b.sorted) {
+        auto& p = b.paths[index];
+        const auto& rec = b.hits[index];
+        const auto& mat = materials[rec.material_id];
+
+        if (mat.type == material_type::diffuse_light)
+            p.radiance += p.throughput * emitted_light(mat, lights, rec, p.from);
+
+        // A path that has traced max_depth rays gathers no more light.
+        if (p.depth >= depths.max_depth) {
+            finish(b, index, color(0, 0, 0));
+            continue;
+        }
+
+        thread_rng() = p.rng;
+
+        ray scattered;
+        color attenuation;
+        bool alive = mat.scatter(p.r, rec, attenuation, scattered);
+
+        if (alive) {
+            auto type = static_cast<int>(mat.bounce());
+            alive = ++p.bounces[type] <= depths.bounce_limit[type];
+        }
+
+        if (alive) {
+            p.from = {rec.p, 0};
+            if (mat.samples_lights() && !lights.empty()) {
+                shadow_query q;
+                if (sample_direct_light(mat, lights, p.r, rec, q)) {
+                    q.radiance = p.throughput * q.radiance;
+                    b.shadows.push_back(q);
+                    b.shadow_paths.push_back(index);
+                }
+                p.from.pdf = mat.pdf(rec, unit_vector(scattered.direction()));
+            }
+
+            p.throughput = p.throughput * attenuation;
+
+            if (depths.roulette_depth >= 0 && p.depth >= depths.roulette_depth) {
+                auto survival = std::min<real>(
+                    fmax(p.throughput.x(), fmax(p.throughput.y(), p.throughput.z())), real(0.95));
+                if (random_double() >= survival)
+                    alive = false;
+                else
+                    p.throughput /= survival;
+            }
+        }
+
+        p.rng = thread_rng();
+        if (!alive) {
+            finish(b, index, color(0, 0, 0));
+            continue;
+        }
+
+        p.r = scattered;
+        b.active.push_back(index);
+    }
+}
+
+// Traces the shadow rays of the light samples taken by shade(). They come
+// before the next extend(), so every path adds up its light in the same order
+// as in path_integrator.
+uint64_t wavefront_integrator::trace_shadows(batch& b) const {
+    add_count(counter::shadow_rays, b.shadows.size());
+    for (size_t k = 0; k < b.shadows.size(); ++k) {
+        const auto& q = b.shadows[k];
+        if (!world.occluded(q.r, 0, q.t_max))
+            b.paths[b.shadow_paths[k]].radiance += q.radiance;
+    }
+    return b.shadows.size();
+}
+
+// Adds the last of the light a path gathers.
+void wavefront_integrator::finish(batch& b, uint32_t index, const color& radiance) const {
+    b.paths[index].radiance += radiance;
+}
+
+#endif